@@ -12,65 +12,729 @@
 #include <stdlib.h> 
 #include <unistd.h> 
 #include <iostream> 
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <sched.h>
+#include <coroutine>
+#ifdef HAVE_NUMA
+#include <numa.h>
+#endif
 #include "skiplist.h"
+#include "fatskiplist.h"
+#include "trace.h"
 
-skiplist<int, int> list(0, INT_MAX);
-vector<vector<long>> not_found;
+//-DFAT_NODES swaps in the skip list of 16-key leaves behind the same calls;
+//-DEXPECTED_KEYS=n sizes MAXLEVEL for about n keys instead of the default 16
+#ifdef FAT_NODES
+template<class K, class V> using ListEngine = fat_skiplist<K, V>;
+#elif defined(EXPECTED_KEYS)
+template<class K, class V> using ListEngine = sized_skiplist<K, V, EXPECTED_KEYS>;
+#else
+template<class K, class V> using ListEngine = skiplist<K, V>;
+#endif
+
+//Keys are 64-bit end to end; build with -DSTRING_KEYS to run the same
+//traces with the decimal string of each key instead
+#ifdef STRING_KEYS
+typedef std::string ListKey;
+ListKey make_key(long num) { return std::to_string(num); }
+ListEngine<ListKey, long> list("", std::string(8, '\xff'));
+#else
+typedef long ListKey;
+ListKey make_key(long num) { return num; }
+ListEngine<ListKey, long> list;
+#endif
+
+struct Work{
+        ListKey key;
+        long value;
+        char action;
+};
+
+//Define the Worker Queue
+vector<queue<Work>> WorkQueue;
+vector<vector<ListKey>> not_found;
 
 int thread_sz = 1;
+int find_group = FIND_GROUP;    // -G: consecutive queries looked up together
+int interleave = 1;             // -W: operations each worker keeps in flight
+bool freeze_auto = false;       // -F: serve write-free phases from a frozen copy
+int write_batch = 0;            // -B: writes each worker buffers before applying
+bool hash_index = false;        // -X: point lookups go through a hash index
+#define MAX_WRITE_BATCH 4096
+#define MAX_INTERLEAVE 64
+
+//Thread placement (-A compact|scatter). Built with -DHAVE_NUMA (make NUMA=1),
+//CPUs are grouped by NUMA node as libnuma reports them; otherwise, or without
+//libnuma support on the host, everything is one node and only the pinning
+//happens.
+const char* place_mode = nullptr;
+vector<int> place_cpu;          // CPU of worker i
+vector<int> place_node;         // its NUMA node
+int place_nodes = 1;
+
+void place_init()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    vector<vector<int>> cpus;
+#ifdef HAVE_NUMA
+    if (numa_available() >= 0) {
+	struct bitmask* mask = numa_allocate_cpumask();
+	for (int node = 0; node <= numa_max_node(); node++) {
+	    vector<int> mine;
+	    if (numa_node_to_cpus(node, mask) == 0) {
+		for (int c = 0; c < (int)mask->size && c < CPU_SETSIZE; c++)
+		    if (numa_bitmask_isbitset(mask, c) && CPU_ISSET(c, &allowed))
+			mine.push_back(c);
+	    }
+	    if (!mine.empty())
+		cpus.push_back(mine);
+	}
+	numa_free_cpumask(mask);
+    }
+#endif
+    if (cpus.empty()) {
+	cpus.resize(1);
+	for (int c = 0; c < CPU_SETSIZE; c++)
+	    if (CPU_ISSET(c, &allowed))
+		cpus[0].push_back(c);
+    }
+    place_nodes = cpus.size();
+
+    //compact fills a node before moving on, scatter deals threads out
+    //round-robin across nodes
+    vector<pair<int,int>> order;
+    if (strcmp(place_mode, "scatter") == 0) {
+	size_t most = 0;
+	for (auto& c : cpus) most = std::max(most, c.size());
+	for (size_t i = 0; i < most; i++)
+	    for (int n = 0; n < place_nodes; n++)
+		if (i < cpus[n].size())
+		    order.push_back({cpus[n][i], n});
+    } else {
+	for (int n = 0; n < place_nodes; n++)
+	    for (int c : cpus[n])
+		order.push_back({c, n});
+    }
+
+    place_cpu.resize(thread_sz);
+    place_node.resize(thread_sz);
+    for (int i = 0; i < thread_sz; i++) {
+	place_cpu[i] = order[i % order.size()].first;
+	place_node[i] = order[i % order.size()].second;
+    }
+}
+
+//Pin the calling worker; its node pool then fills with local memory
+void place_self(int worker_id)
+{
+    if (!place_mode)
+	return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(place_cpu[worker_id], &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+	perror("sched_setaffinity");
+}
+
+void place_report(const long* ops, double elapsed_time)
+{
+    if (!place_mode)
+	return;
+    for (int n = 0; n < place_nodes; n++) {
+	int threads = 0;
+	long total = 0;
+	for (int i = 0; i < thread_sz; i++) {
+	    if (place_node[i] == n) {
+		threads++;
+		total += ops[i];
+	    }
+	}
+	printf("Node %d: %d threads, %ld ops, %.0f ops/sec\n", n, threads, total,
+	       (double) total / elapsed_time);
+    }
+}
+
+//One trace operation as a coroutine. It suspends after every node hop of
+//its search (each hop prefetches the next node), so the worker can resume
+//other operations while that line arrives, then finishes the operation.
+struct OpTask {
+    struct promise_type {
+	OpTask get_return_object() { return { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	std::suspend_always final_suspend() noexcept { return {}; }
+	void return_void() {}
+	void unhandled_exception() { std::terminate(); }
+
+	//Every frame has the same size, so each thread recycles its own
+	struct FrameCache {
+	    size_t size = 0;
+	    vector<void*> frames;
+	    ~FrameCache() { for (void* f : frames) ::operator delete(f); }
+	};
+	static thread_local FrameCache cache;
+
+	static void* operator new(size_t sz) {
+	    if (sz == cache.size && !cache.frames.empty()) {
+		void* f = cache.frames.back();
+		cache.frames.pop_back();
+		return f;
+	    }
+	    return ::operator new(sz);
+	}
+	static void operator delete(void* f, size_t sz) {
+	    if (cache.frames.size() < MAX_INTERLEAVE && (cache.frames.empty() || sz == cache.size)) {
+		cache.size = sz;
+		cache.frames.push_back(f);
+	    } else {
+		::operator delete(f);
+	    }
+	}
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+thread_local OpTask::promise_type::FrameCache OpTask::promise_type::cache;
+
+OpTask run_op(Work w, int worker_id)
+{
+    decltype(list)::Search s;
+    list.search_begin(s, w.key, w.action != 'q');
+    while (!list.search_step(s))
+	co_await std::suspend_always{};
+
+    if (w.action == 'i') {
+	list.insert_at(s, std::move(w.key), w.value);
+    } else if (w.action == 'q') {
+	long val;
+	if (!list.find_at(s, val))
+	    not_found[worker_id].push_back(std::move(w.key));
+    } else {
+	list.erase_at(s);
+    }
+}
+
+//-W width: the worker's queue runs as up to width coroutines resumed
+//round-robin. An operation only starts once no operation on the same key is
+//in flight, so every key still sees its operations in trace order.
+void interleaved_work(int worker_id)
+{
+    queue<Work>& work = WorkQueue[worker_id];
+    vector<OpTask> tasks;
+    vector<ListKey> keys;       // key of tasks[i]
+
+    while (!work.empty() || !tasks.empty()) {
+	while ((int)tasks.size() < interleave && !work.empty()) {
+	    Work& next = work.front();
+	    if (std::find(keys.begin(), keys.end(), next.key) != keys.end())
+		break;
+	    keys.push_back(next.key);
+	    tasks.push_back(run_op(std::move(next), worker_id));
+	    work.pop();
+	}
+	for (size_t i = 0; i < tasks.size(); ) {
+	    tasks[i].handle.resume();
+	    if (tasks[i].handle.done()) {
+		tasks[i].handle.destroy();
+		tasks[i] = tasks.back();
+		tasks.pop_back();
+		keys[i] = std::move(keys.back());
+		keys.pop_back();
+	    } else {
+		i++;
+	    }
+	}
+    }
+}
+
+//Write-combining buffer (-B): a worker's pending writes, sorted by key, the
+//last write to a key replacing earlier ones. The trace is split by key, so
+//the buffer holds the latest state of every key it has and answers the
+//worker's own lookups on them exactly.
+struct WriteBuffer {
+    vector<ListKey> keys;
+    vector<long> values;
+    unique_ptr<bool[]> erased;
+    int n = 0;
+
+    explicit WriteBuffer(int cap) : keys(cap), values(cap), erased(new bool[cap]) {}
+
+    void add(ListKey key, long value, bool erase)
+    {
+	int pos = lower_bound(keys.begin(), keys.begin() + n, key) - keys.begin();
+	if (pos < n && keys[pos] == key) {
+	    values[pos] = value;
+	    erased[pos] = erase;
+	    return;
+	}
+	if (n == (int)keys.size()) {
+	    flush();
+	    pos = 0;
+	}
+	move_backward(keys.begin() + pos, keys.begin() + n, keys.begin() + n + 1);
+	move_backward(values.begin() + pos, values.begin() + n, values.begin() + n + 1);
+	move_backward(erased.get() + pos, erased.get() + n, erased.get() + n + 1);
+	keys[pos] = std::move(key);
+	values[pos] = value;
+	erased[pos] = erase;
+	n++;
+    }
+
+    //1 if buffered as inserted, 0 if buffered as erased, -1 if not buffered
+    int find(const ListKey& key, long& value) const
+    {
+	int pos = lower_bound(keys.begin(), keys.begin() + n, key) - keys.begin();
+	if (pos == n || !(keys[pos] == key))
+	    return -1;
+	if (erased[pos])
+	    return 0;
+	value = values[pos];
+	return 1;
+    }
+
+    void flush()
+    {
+	list.apply_sorted(keys.data(), values.data(), erased.get(), n);
+	n = 0;
+    }
+};
 
 void *thread_work(void* arg)
 {
     int worker_id = *static_cast<int*>(arg);
-    int num;
     char action;
+    place_self(worker_id);
+    list.TrashBind(worker_id);
+
+    if (interleave > 1) {
+	interleaved_work(worker_id);
+	pthread_exit(NULL);
+    }
+
+    queue<Work>& work = WorkQueue[worker_id];
+    unique_ptr<WriteBuffer> buffer;
+    if (write_batch > 0)
+	buffer.reset(new WriteBuffer(write_batch));
 
-    struct Work curr_work;
-    while(!WorkQueue[worker_id].empty())
+    while(!work.empty())
     {
-	curr_work = WorkQueue[worker_id].front();
-	WorkQueue[worker_id].pop();
+	Work& curr_work = work.front();
 	action = curr_work.action;
-	num = curr_work.key;
 
 	if ( action == 'i' ) {
-	    //printf("i%d\n",num);
-	    list.insert(num, num);
+	    if (buffer)
+		buffer->add(std::move(curr_work.key), curr_work.value, false);
+	    else
+		list.insert(std::move(curr_work.key), curr_work.value);
 	} else if ( action == 'q' ) {
-	    int val;
-	    //printf("q%d\n",num);
-	    if (!list.find(num, val))
-		not_found[worker_id].push_back(num);
+	    //A run of queries has no writes in between: overlap the lookups
+	    ListKey keys[FIND_GROUP];
+	    long vals[FIND_GROUP];
+	    bool found[FIND_GROUP];
+	    int m = 0;
+	    while (m < find_group && !work.empty() && work.front().action == 'q') {
+		long val;
+		int buffered = buffer ? buffer->find(work.front().key, val) : -1;
+		if (buffered == 0)
+		    not_found[worker_id].push_back(std::move(work.front().key));
+		else if (buffered < 0)
+		    keys[m++] = std::move(work.front().key);
+		work.pop();
+	    }
+	    list.find_many(keys, m, vals, found);
+	    for (int i = 0; i < m; i++)
+		if (!found[i])
+		    not_found[worker_id].push_back(std::move(keys[i]));
+	    continue;
 	} else if ( action == 'd' ) {
-	    //printf("d%d\n",num);
-	    list.erase(num);
+	    if (buffer)
+		buffer->add(std::move(curr_work.key), 0, true);
+	    else
+		list.erase(curr_work.key);
+	}
+	work.pop();
+    }
+    if (buffer)
+	buffer->flush();
+
+    pthread_exit(NULL);
+}
+
+//Closed-loop mode (-L): each thread draws its own ops for a fixed duration
+double load_secs = 0;           // 0 replays <infile>
+int load_ins = 40;              // insert %
+int load_del = 20;              // delete %
+char load_dist = 'u';           // 'u'niform, 'z'ipf or 'h'ot
+long load_range = 1000000;      // keys are drawn from [0, load_range)
+double load_theta = 0.99;       // zipf skew
+int load_hot_ops = 90;          // hot: hot_ops% of ops go to the first hot_keys% of keys
+int load_hot_keys = 10;
+long load_preload = 0;          // keys inserted before the clock starts
+int load_interval_ms = 100;     // reporting interval
+const char* load_checkpoint = nullptr;  // -C: snapshot the list to this file mid-run
+std::atomic<bool> load_stop(false);
+
+struct alignas(64) LoadStats {
+    std::atomic<long> ops;
+    long inserts, deletes, queries, hits;
+};
+LoadStats* load_stats;
+
+//xorshift64* stream, one per thread (rand() serialises on its internal lock)
+struct LoadRng {
+    unsigned long s;
+    unsigned long next() {
+	s ^= s >> 12; s ^= s << 25; s ^= s >> 27;
+	return s * 2685821657736338717UL;
+    }
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+};
+
+//Zipf ranks over [0, n), same sampler as inputgen -k zipf
+struct LoadZipf {
+    long n;
+    double alpha, zetan, eta, half_pow_theta;
+
+    void init(long range, double theta) {
+	double zeta2 = 0.0;
+	n = range;
+	zetan = 0.0;
+	for (long i = 1; i <= n; i++) {
+	    zetan += 1.0 / pow((double)i, theta);
+	    if (i == 2) zeta2 = zetan;
+	}
+	if (n < 2) zeta2 = zetan;
+	alpha = 1.0 / (1.0 - theta);
+	half_pow_theta = pow(0.5, theta);
+	eta = (n < 2) ? 0.0 : (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    long next(LoadRng& rng) {
+	double u = rng.uniform();
+	double uz = u * zetan;
+	if (uz < 1.0) return 0;
+	if (uz < 1.0 + half_pow_theta) return n > 1 ? 1 : 0;
+	long r = (long)(n * pow(eta * u - eta + 1.0, alpha));
+	return r < n ? r : n - 1;
+    }
+} load_zipf;
+
+long load_key(LoadRng& rng, int worker_id)
+{
+    long k;
+    if (load_dist == 'z') {
+	k = load_zipf.next(rng);
+    } else if (load_dist == 'h') {
+	long hot_n = load_range * load_hot_keys / 100;
+	if (hot_n < 1) hot_n = 1;
+	if (hot_n >= load_range || (long)(rng.next() % 100) < load_hot_ops)
+	    k = rng.next() % hot_n;
+	else
+	    k = hot_n + rng.next() % (load_range - hot_n);
+    } else {
+	k = rng.next() % load_range;
+    }
+    //Like the replay, a key is only ever touched by the thread that owns
+    //key % thread_sz, so move the draw into this thread's residue class
+    k = k - k % thread_sz + worker_id;
+    return k < load_range ? k : k - thread_sz;
+}
+
+void *load_work(void* arg)
+{
+    int worker_id = *static_cast<int*>(arg);
+    LoadStats& st = load_stats[worker_id];
+    LoadRng rng = { 0x9e3779b97f4a7c15UL * (worker_id + 1) };
+    long ops = 0;
+    place_self(worker_id);
+    list.TrashBind(worker_id);
+
+    while (!load_stop.load(std::memory_order_relaxed)) {
+	int choice = rng.next() % 100;
+	long num = load_key(rng, worker_id);
+
+	if ( choice < load_ins ) {
+	    list.insert(make_key(num), num);
+	    st.inserts++;
+	} else if ( choice < load_ins + load_del ) {
+	    list.erase(make_key(num));
+	    st.deletes++;
+	} else {
+	    long val;
+	    if (list.find(make_key(num), val))
+		st.hits++;
+	    st.queries++;
 	}
+	st.ops.store(++ops, std::memory_order_relaxed);
     }
 
     pthread_exit(NULL);
 }
 
+//Exports a snapshot of the list halfway through the run, while the
+//workers keep going
+void *checkpoint_work(void*)
+{
+    struct timespec start, stop, half = { (time_t)(load_secs / 2),
+					 (long)((load_secs / 2 - (time_t)(load_secs / 2)) * BILLION) };
+    nanosleep(&half, nullptr);
+
+    FILE* fout = fopen(load_checkpoint, "w");
+    if (!fout) {
+	perror("fopen");
+	pthread_exit(NULL);
+    }
+    clock_gettime(CLOCK_REALTIME, &start);
+    long n = list.snapshot([fout](const ListKey& key, long value) {
+	std::stringstream sstr;
+	sstr << key << " " << value << "\n";
+	fputs(sstr.str().c_str(), fout);
+    });
+    clock_gettime(CLOCK_REALTIME, &stop);
+    fclose(fout);
+
+    double elapsed_time = (stop.tv_sec - start.tv_sec) +
+			  ((double)(stop.tv_nsec - start.tv_nsec)) / BILLION;
+    printf("Checkpoint: %ld keys written to %s in %.3f sec\n", n, load_checkpoint, elapsed_time);
+    pthread_exit(NULL);
+}
+
+void run_closed_loop()
+{
+    struct timespec start, now;
+    if (load_dist == 'z')
+	load_zipf.init(load_range, load_theta);
+
+    LoadRng rng = { 0x2545f4914f6cdd1dUL };
+    for (long i = 0; i < load_preload; i++) {
+	long num = rng.next() % load_range;
+	list.insert(make_key(num), num);
+    }
+
+    load_stats = new LoadStats[thread_sz]();
+    pthread_t* threads = new pthread_t[thread_sz];
+    int* tids = new int[thread_sz];
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (int i = 0; i < thread_sz; i++){
+	tids[i] = i;
+	if ( pthread_create(&threads[i], nullptr, load_work, (void*)&tids[i]) != 0 ){
+	    perror("pthread_create");
+	    exit(EXIT_FAILURE);
+	}
+    }
+    pthread_t checkpointer;
+    if ( load_checkpoint && pthread_create(&checkpointer, nullptr, checkpoint_work, nullptr) != 0 ){
+	perror("pthread_create");
+	exit(EXIT_FAILURE);
+    }
+
+    //Report ops/sec per interval until the duration is over
+    printf("%10s %14s %14s %12s\n", "time(s)", "ops/sec", "total ops", "size");
+    long prev_total = 0;
+    double prev_time = 0, elapsed_time = 0;
+    struct timespec tick = { load_interval_ms / 1000, (load_interval_ms % 1000) * 1000000L };
+    while (elapsed_time < load_secs) {
+	nanosleep(&tick, nullptr);
+	clock_gettime(CLOCK_REALTIME, &now);
+	elapsed_time = (now.tv_sec - start.tv_sec) +
+		       ((double)(now.tv_nsec - start.tv_nsec)) / BILLION;
+
+	long total = 0;
+	for (int i = 0; i < thread_sz; i++)
+	    total += load_stats[i].ops.load(std::memory_order_relaxed);
+	printf("%10.2f %14.0f %14ld %12ld\n", elapsed_time,
+	       (total - prev_total) / (elapsed_time - prev_time), total, list.size());
+	fflush(stdout);
+	prev_total = total;
+	prev_time = elapsed_time;
+    }
+    load_stop.store(true);
+
+    for (int i = 0; i < thread_sz; i++){
+	if ( pthread_join(threads[i], nullptr) != 0 ){
+	    perror("pthread_join");
+	    exit(EXIT_FAILURE);
+	}
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    if ( load_checkpoint && pthread_join(checkpointer, nullptr) != 0 ){
+	perror("pthread_join");
+	exit(EXIT_FAILURE);
+    }
+    elapsed_time = (now.tv_sec - start.tv_sec) +
+		   ((double)(now.tv_nsec - start.tv_nsec)) / BILLION;
+
+    long total = 0, inserts = 0, deletes = 0, queries = 0, hits = 0;
+    vector<long> thread_ops(thread_sz);
+    for (int i = 0; i < thread_sz; i++) {
+	thread_ops[i] = load_stats[i].ops.load();
+	total += thread_ops[i];
+	inserts += load_stats[i].inserts;
+	deletes += load_stats[i].deletes;
+	queries += load_stats[i].queries;
+	hits += load_stats[i].hits;
+    }
+
+    list.TrashEmpty();
+
+    delete[] threads;
+    delete[] tids;
+    delete[] load_stats;
+
+    cout << "Inserts: " << inserts << " Deletes: " << deletes
+	 << " Queries: " << queries << " (hits " << hits << ")" << endl;
+    cout << "Final size: " << list.size() << endl;
+    cout << "Elapsed time: " << elapsed_time << " sec" << endl;
+    cout << "Throughput: " << (double) total / elapsed_time << " ops/sec" << endl;
+    place_report(thread_ops.data(), elapsed_time);
+}
+
 int main(int argc, char* argv[])
 {
-    int count = 0;
+    long count = 0;     // trace records; block-mode traces can pass 2^31
     struct timespec start, stop;
     bool printFlag = false;  // -p option: whether to print or not
 
+    const char* usage =
+        "Usage: %s [-p] <infile> <num_threads>\n"
+        "       %s -L <secs> [-m ins%%:del%%] [-k uniform|zipf|hot] [-r keyrange]\n"
+        "          [-z theta] [-H hot_ops%%:hot_keys%%] [-P preload] [-I interval_ms]\n"
+        "          [-C checkpoint_file] <num_threads>\n"
+        "       -A compact|scatter pins the workers and gives each a node-local pool\n"
+        "       -G group looks up to group consecutive queries together (1-%d)\n"
+        "       -W width interleaves up to width operations per worker as coroutines (1-%d);\n"
+        "          a width above 1 cannot be combined with -B, -F or -X\n"
+        "       -F answers lookups from a frozen sorted copy once the list stops changing\n"
+        "       -B batch buffers up to batch writes per worker, applied in key order (1-%d)\n"
+        "       -X keeps a hash index of the keys for point lookups\n";
+
     int opt;
     extern char* optarg;
-    while ((opt = getopt(argc, argv, "p")) != -1) {
+    while ((opt = getopt(argc, argv, "pL:m:k:r:z:H:P:I:C:A:G:W:FB:X")) != -1) {
         switch (opt) {
             case 'p':
                 printFlag = true;
                 break;
+            case 'L':
+                load_secs = atof(optarg);
+                break;
+            case 'm':
+                if (sscanf(optarg, "%d:%d", &load_ins, &load_del) != 2) {
+                    fprintf(stderr, usage, argv[0], argv[0], FIND_GROUP, MAX_INTERLEAVE, MAX_WRITE_BATCH);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'k':
+                load_dist = optarg[0];
+                break;
+            case 'r':
+                load_range = atol(optarg);
+                break;
+            case 'z':
+                load_theta = atof(optarg);
+                break;
+            case 'H':
+                if (sscanf(optarg, "%d:%d", &load_hot_ops, &load_hot_keys) != 2) {
+                    fprintf(stderr, usage, argv[0], argv[0], FIND_GROUP, MAX_INTERLEAVE, MAX_WRITE_BATCH);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'P':
+                load_preload = atol(optarg);
+                break;
+            case 'I':
+                load_interval_ms = atoi(optarg);
+                break;
+            case 'C':
+                load_checkpoint = optarg;
+                break;
+            case 'A':
+                if (strcmp(optarg, "compact") != 0 && strcmp(optarg, "scatter") != 0) {
+                    fprintf(stderr, usage, argv[0], argv[0], FIND_GROUP, MAX_INTERLEAVE, MAX_WRITE_BATCH);
+                    exit(EXIT_FAILURE);
+                }
+                place_mode = optarg;
+                break;
+            case 'G':
+                find_group = atoi(optarg);
+                if (find_group < 1 || find_group > FIND_GROUP) {
+                    fprintf(stderr, usage, argv[0], argv[0], FIND_GROUP, MAX_INTERLEAVE, MAX_WRITE_BATCH);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'W':
+                interleave = atoi(optarg);
+                if (interleave < 1 || interleave > MAX_INTERLEAVE) {
+                    fprintf(stderr, usage, argv[0], argv[0], FIND_GROUP, MAX_INTERLEAVE, MAX_WRITE_BATCH);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'F':
+                freeze_auto = true;
+                break;
+            case 'X':
+                hash_index = true;
+                break;
+            case 'B':
+                write_batch = atoi(optarg);
+                if (write_batch < 1 || write_batch > MAX_WRITE_BATCH) {
+                    fprintf(stderr, usage, argv[0], argv[0], FIND_GROUP, MAX_INTERLEAVE, MAX_WRITE_BATCH);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-p] <infile>\n", argv[0]);
+                fprintf(stderr, usage, argv[0], argv[0], FIND_GROUP, MAX_INTERLEAVE, MAX_WRITE_BATCH);
                 exit(EXIT_FAILURE);
         }
     }
 
+    //the coroutine workers go straight to the list, past the write buffer,
+    //the frozen copy and the hash index
+    if (interleave > 1 && (write_batch > 0 || freeze_auto || hash_index)) {
+        fprintf(stderr, "-W cannot be combined with -B, -F or -X\n");
+        fprintf(stderr, usage, argv[0], argv[0], FIND_GROUP, MAX_INTERLEAVE, MAX_WRITE_BATCH);
+        exit(EXIT_FAILURE);
+    }
+
+    if (load_secs > 0) {
+        if (optind >= argc) {
+            fprintf(stderr, usage, argv[0], argv[0], FIND_GROUP, MAX_INTERLEAVE, MAX_WRITE_BATCH);
+            exit(EXIT_FAILURE);
+        }
+        thread_sz = atoi(argv[optind]);
+        if (thread_sz <= 0) {
+            fprintf(stderr, "num_threads must be > 0 \n");
+            exit(EXIT_FAILURE);
+        }
+        if (load_ins < 0 || load_del < 0 || load_ins + load_del > 100 ||
+            (load_dist != 'u' && load_dist != 'z' && load_dist != 'h') ||
+            load_range < thread_sz ||
+            load_theta < 0.0 || load_theta >= 1.0 ||
+            load_hot_ops < 0 || load_hot_ops > 100 || load_hot_keys <= 0 || load_hot_keys > 100 ||
+            load_interval_ms <= 0) {
+            fprintf(stderr, "invalid closed-loop configuration\n");
+            fprintf(stderr, usage, argv[0], argv[0], FIND_GROUP, MAX_INTERLEAVE, MAX_WRITE_BATCH);
+            exit(EXIT_FAILURE);
+        }
+        list.TrashSet();
+        if (place_mode) {
+            place_init();
+            list.PoolEnable();
+        }
+        if (freeze_auto)
+            list.FreezeEnable();
+        if (hash_index)
+            list.HashEnable(load_range);
+        run_closed_loop();
+        return EXIT_SUCCESS;
+    }
+
     if (optind+1 >= argc) {
-        fprintf(stderr, "Usage: %s [-p] <infile>\n", argv[0]);
+        fprintf(stderr, usage, argv[0], argv[0], FIND_GROUP, MAX_INTERLEAVE, MAX_WRITE_BATCH);
         exit(EXIT_FAILURE);
     }
 
@@ -88,26 +752,51 @@ int main(int argc, char* argv[])
     WorkQueue.resize(thread_sz);
     list.TrashSet();
     not_found.resize(thread_sz);
+    if (place_mode) {
+        place_init();
+        list.PoolEnable();
+    }
+    if (freeze_auto)
+        list.FreezeEnable();
+
+    // binary traces (inputgen -b) carry their record count in the header
+    trace_header hdr;
+    bool binary = fread(&hdr, sizeof(hdr), 1, fin) == 1 &&
+                  memcmp(hdr.magic, TRACE_MAGIC, TRACE_MAGIC_LEN) == 0;
 
     // count the number of lines and buffer the input file in the page cache.       
-    int totalLines = 0;
+    long totalLines = 0;
     char tmp[256];
-    while (fgets(tmp, sizeof(tmp), fin)) totalLines++;
-    rewind(fin);
+    if (binary) {
+        totalLines = (long)hdr.count;
+    } else {
+        rewind(fin);
+        while (fgets(tmp, sizeof(tmp), fin)) totalLines++;
+        rewind(fin);
+    }
+    // every line could insert a new key
+    if (hash_index)
+        list.HashEnable(totalLines);
 
     clock_gettime(CLOCK_REALTIME, &start);
 
     char action;
     long num;
-    int lineNo = 0;
+    long lineNo = 0;
     //1-phase : Distribute the query to each worker queue
-    while (fscanf(fin, "%c %ld\n", &action, &num) > 0) {
+    trace_record rec;
+    while (binary ? fread(&rec, sizeof(rec), 1, fin) == 1
+                  : fscanf(fin, "%c %ld\n", &action, &num) > 0) {
+        if (binary) {
+            action = rec.type;
+            num = rec.key;
+        }
         lineNo++;
 	//hashing the number & push into queue
-	long h = num % thread_sz;
-	if (h < 0) h += thread_sz;
         if (action == 'i' || action == 'q' || action == 'd') {
-            WorkQueue[h].push({num,action});
+	    long h = num % thread_sz;
+	    if (h < 0) h += thread_sz;
+            WorkQueue[h].push({make_key(num), num, action});
         } else {
             printf("ERROR: Unrecognized action: '%c'\n", action);
             exit(EXIT_FAILURE);
@@ -117,14 +806,17 @@ int main(int argc, char* argv[])
 
         // ANSI progress rate     
         if (printFlag && (lineNo % (totalLines / 100) == 0 || lineNo == totalLines)) {
-            int percent = (lineNo * 100) / totalLines;
-            printf("\r\033[KLine %d / %d, Progress: %d%%", lineNo, totalLines, percent);
+            int percent = (int)(lineNo * 100 / totalLines);
+            printf("\r\033[KLine %ld / %ld, Progress: %d%%", lineNo, totalLines, percent);
             fflush(stdout);
         }
     }
     fclose(fin);
 
     //2-phase : Create pthread & Process the queries
+    vector<long> thread_ops(thread_sz);
+    for (int i = 0; i < thread_sz; i++)
+	thread_ops[i] = WorkQueue[i].size();
     pthread_t* threads = new pthread_t[thread_sz];
     int* tids = new int[thread_sz];
 
@@ -149,8 +841,8 @@ int main(int argc, char* argv[])
     delete[] tids;
 
     for ( int i = 0; i < thread_sz; i++ ){
-	for ( long k : not_found[i] ){
-	    printf("ERROR: Not Found: %ld\n", k);
+	for ( const ListKey& k : not_found[i] ){
+	    cout << "ERROR: Not Found: " << k << "\n";
 	}
     }
 
@@ -159,12 +851,14 @@ int main(int argc, char* argv[])
     clock_gettime(CLOCK_REALTIME, &stop);
 
     cout << "Final skiplist keys: " << list.printList() << endl;
+    cout << "Final size: " << list.size() << endl;
 
     double elapsed_time = (stop.tv_sec - start.tv_sec) +
                           ((double)(stop.tv_nsec - start.tv_nsec)) / BILLION;
 
     cout << "Elapsed time: " << elapsed_time << " sec" << endl;
     cout << "Throughput: " << (double) count / elapsed_time << " ops/sec" << endl;
+    place_report(thread_ops.data(), elapsed_time);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,498 @@
+/*
+ * fatskiplist.h
+ *
+ * Skip list of arrays: the same insert/find/erase interface as skiplist,
+ * but every node is a leaf holding up to FAT_KEYS sorted keys, so a lookup
+ * touches a couple of cache lines in one leaf instead of one line per key.
+ * The skip list levels index the leaves by their low fence.
+ *
+ * Build the driver with -DFAT_NODES to use it.
+ */
+
+#ifndef FATSKIPLIST_H
+#define FATSKIPLIST_H
+
+#include "skiplist.h"
+#include <type_traits>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#define FAT_KEYS 16     // keys per leaf
+
+template<class K,class V,int MAXLEVEL>
+class fat_skiplist_node
+{
+public:
+    fat_skiplist_node(const K& lowKey, const K& fill):low(lowKey)
+    {
+	count = 0;
+	toplevel = 1;
+	dead = false;
+        for (int i = 0; i < FAT_KEYS; i++) {
+            keys[i] = fill;
+        }
+        for (int i = 1; i <= MAXLEVEL; i++) {
+            forwards[i] = nullptr;
+        }
+    }
+
+    //sorted; slots past count hold the max key so a full-width SIMD
+    //compare needs no mask
+    alignas(64) K keys[FAT_KEYS];
+    V values[FAT_KEYS];
+    K low;              // fence: the leaf holds keys in [low, next leaf's low)
+    int count;
+    int toplevel;
+    bool dead;          // unlinked; its keys now belong to the leaf before it
+    fat_skiplist_node<K,V,MAXLEVEL>* forwards[MAXLEVEL+1];
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    std::atomic<unsigned> version{0};   // odd while a writer changes the leaf
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+//Locking: the leaf index (fences and links) is guarded by index_lock.
+//In-place leaf updates hold it shared plus the leaf's mutex; splitting a
+//full leaf or unlinking an empty one takes it exclusively. Every change to
+//a leaf's contents, fence successor or dead flag is bracketed by its
+//version (a seqlock), so lookups take no lock and write no shared line:
+//they descend without index_lock, read the leaf, and retry if its version
+//moved. If the leaf no longer covers the key (split or unlinked on the
+//way), they fall back to the shared lock. Unlinked leaves may still be
+//reached by such a descent, so they are kept until TrashEmpty. Keys or
+//values that are not trivially copyable cannot be read torn, so with them
+//lookups take the leaf's mutex instead. index_lock prefers writers, so a
+//split is not starved by a stream of shared holders.
+//
+//Scaling limit: every insert and erase still takes index_lock shared,
+//and a split (about one in FAT_KEYS/2 inserts of new keys) or an unlink
+//stops all of them while it runs. Write-heavy runs therefore serialize
+//on the index far sooner than with skiplist, which locks single nodes.
+template<class K, class V, int MAXLEVEL = 16>
+class fat_skiplist
+{
+public:
+    typedef K KeyType;
+    typedef V ValueType;
+    typedef fat_skiplist_node<K,V,MAXLEVEL> NodeType;
+
+    //Integer keys take the sentinels from the type's own range
+    template<class T = K, class = typename std::enable_if<std::is_integral<T>::value>::type>
+    fat_skiplist():fat_skiplist(std::numeric_limits<K>::min(), std::numeric_limits<K>::max())
+    {
+    }
+
+    fat_skiplist(K minKey,K maxKey):max_level(MAXLEVEL),max_curr_level(1),
+                                    m_minKey(minKey),m_maxKey(maxKey),m_size(0)
+    {
+        m_pHeader = new NodeType(m_minKey, m_maxKey);
+    }
+
+    ~fat_skiplist()
+    {
+        NodeType* currNode = m_pHeader;
+        while (currNode) {
+            NodeType* tempNode = currNode;
+            currNode = currNode->forwards[1];
+            delete tempNode;
+        }
+        TrashEmpty();
+    }
+
+    void insert(K searchKey,V newValue)
+    {
+        pthread_rwlock_rdlock(&index_lock);
+        NodeType* leaf = findLeaf(searchKey, nullptr);
+        pthread_mutex_lock(&leaf->lock);
+        int pos = lowerBound(leaf, searchKey);
+        bool done = true;
+        if (pos < leaf->count && leaf->keys[pos] == searchKey) {
+            writeBegin(leaf);
+            leaf->values[pos] = std::move(newValue);
+            writeEnd(leaf);
+        } else if (leaf->count < FAT_KEYS) {
+            writeBegin(leaf);
+            insertAt(leaf, pos, std::move(searchKey), std::move(newValue));
+            writeEnd(leaf);
+        } else {
+            done = false;
+        }
+        pthread_mutex_unlock(&leaf->lock);
+        pthread_rwlock_unlock(&index_lock);
+        if (done)
+            return;
+
+        //Full leaf: split it with the index to ourselves
+        NodeType* update[MAXLEVEL+1];
+        pthread_rwlock_wrlock(&index_lock);
+        leaf = findLeaf(searchKey, update);
+        pos = lowerBound(leaf, searchKey);
+        if (pos < leaf->count && leaf->keys[pos] == searchKey) {
+            writeBegin(leaf);
+            leaf->values[pos] = std::move(newValue);
+            writeEnd(leaf);
+        } else {
+            if (leaf->count == FAT_KEYS) {
+                NodeType* right = split(leaf, update);
+                if (!(searchKey < right->low))
+                    leaf = right;
+                pos = lowerBound(leaf, searchKey);
+            }
+            writeBegin(leaf);
+            insertAt(leaf, pos, std::move(searchKey), std::move(newValue));
+            writeEnd(leaf);
+        }
+        pthread_rwlock_unlock(&index_lock);
+    }
+
+    void erase(const K& searchKey)
+    {
+        pthread_rwlock_rdlock(&index_lock);
+        NodeType* leaf = findLeaf(searchKey, nullptr);
+        pthread_mutex_lock(&leaf->lock);
+        int pos = lowerBound(leaf, searchKey);
+        bool emptied = false;
+        if (pos < leaf->count && leaf->keys[pos] == searchKey) {
+            writeBegin(leaf);
+            for (int i = pos; i + 1 < leaf->count; i++) {
+                leaf->keys[i] = std::move(leaf->keys[i+1]);
+                leaf->values[i] = std::move(leaf->values[i+1]);
+            }
+            leaf->count--;
+            leaf->keys[leaf->count] = m_maxKey;
+            writeEnd(leaf);
+            m_size.fetch_add(-1, std::memory_order_relaxed);
+            emptied = leaf->count == 0 && leaf != m_pHeader;
+        }
+        pthread_mutex_unlock(&leaf->lock);
+        pthread_rwlock_unlock(&index_lock);
+
+        if (emptied) {
+            pthread_rwlock_wrlock(&index_lock);
+            leaf = findLeaf(searchKey, nullptr);
+            if (leaf->count == 0 && leaf != m_pHeader)
+                unlink(leaf);
+            pthread_rwlock_unlock(&index_lock);
+        }
+    }
+
+    //Applies n writes with ascending keys one at a time
+    void apply_sorted(K* keys, V* values, const bool* erased, int n)
+    {
+        for (int i = 0; i < n; i++) {
+            if (erased[i])
+                erase(keys[i]);
+            else
+                insert(std::move(keys[i]), std::move(values[i]));
+        }
+    }
+
+    bool find(const K& searchKey, V& outValue)
+    {
+        //A leaf's low fence never changes, so it covers the key unless it
+        //was unlinked or a split moved the key to a new next leaf
+        if constexpr (std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value) {
+            for (;;) {
+                NodeType* leaf = findLeaf(searchKey, nullptr);
+                unsigned v = leaf->version.load(std::memory_order_acquire);
+                if (v & 1)
+                    continue;
+                NodeType* next = leaf->forwards[1];
+                bool covers = !leaf->dead && (!next || searchKey < next->low);
+                V value;
+                bool found = findIn(leaf, searchKey, value);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (leaf->version.load(std::memory_order_relaxed) != v)
+                    continue;
+                if (!covers)
+                    break;
+                if (found)
+                    outValue = value;
+                return found;
+            }
+        } else {
+            NodeType* leaf = findLeaf(searchKey, nullptr);
+            pthread_mutex_lock(&leaf->lock);
+            NodeType* next = leaf->forwards[1];
+            if (!leaf->dead && (!next || searchKey < next->low)) {
+                bool found = findIn(leaf, searchKey, outValue);
+                pthread_mutex_unlock(&leaf->lock);
+                return found;
+            }
+            pthread_mutex_unlock(&leaf->lock);
+        }
+
+        pthread_rwlock_rdlock(&index_lock);
+        NodeType* leaf = findLeaf(searchKey, nullptr);
+        pthread_mutex_lock(&leaf->lock);
+        bool found = findIn(leaf, searchKey, outValue);
+        pthread_mutex_unlock(&leaf->lock);
+        pthread_rwlock_unlock(&index_lock);
+        return found;
+    }
+
+    int find_many(const K* keys, int n, V* outValues, bool* found)
+    {
+        int hits = 0;
+        for (int i = 0; i < n; i++) {
+            found[i] = find(keys[i], outValues[i]);
+            hits += found[i];
+        }
+        return hits;
+    }
+
+    //The coroutine driver (-W) drives skiplist searches hop by hop. Here the
+    //descent has to happen under the index lock, so the search is a single
+    //step and the operation runs whole in *_at.
+    struct Search {
+        const K* key;
+    };
+
+    void search_begin(Search& s, const K& searchKey, bool)
+    {
+        s.key = &searchKey;
+    }
+
+    bool search_step(Search&)
+    {
+        return true;
+    }
+
+    void insert_at(Search&, K searchKey, V newValue)
+    {
+        insert(std::move(searchKey), std::move(newValue));
+    }
+
+    void erase_at(Search& s)
+    {
+        erase(*s.key);
+    }
+
+    bool find_at(Search& s, V& outValue)
+    {
+        return find(*s.key, outValue);
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    long size() const
+    {
+        long n = m_size.load(std::memory_order_relaxed);
+        return n > 0 ? n : 0;
+    }
+
+    //Calls emit(key, value) for every key, in ascending order, as of one
+    //instant: writers wait for the walk. Returns the number of keys.
+    template<class F>
+    long snapshot(F emit)
+    {
+        long count = 0;
+        pthread_rwlock_wrlock(&index_lock);
+        for (NodeType* leaf = m_pHeader; leaf; leaf = leaf->forwards[1]) {
+            for (int i = 0; i < leaf->count; i++) {
+                emit(leaf->keys[i], leaf->values[i]);
+                count++;
+            }
+        }
+        pthread_rwlock_unlock(&index_lock);
+        return count;
+    }
+
+    std::string printList()
+    {
+        int i = 0;
+        std::stringstream sstr;
+        for (NodeType* leaf = m_pHeader; leaf && i <= 200; leaf = leaf->forwards[1]) {
+            for (int j = 0; j < leaf->count && i <= 200; j++, i++) {
+                sstr << leaf->keys[j] << " ";
+            }
+        }
+        return sstr.str();
+    }
+
+    //Leaves are allocated by plain new and there is one list of unlinked
+    //leaves, so the per-thread trash queues and node pools of skiplist have
+    //nothing to do. TrashEmpty runs once the workers are joined.
+    void TrashSet() {}
+    void TrashBind(int) {}
+    void TrashEmpty()
+    {
+        for (NodeType* leaf : m_retired)
+            delete leaf;
+        m_retired.clear();
+    }
+    void PoolEnable() {}
+
+    //Leaves are already arrays; there is no separate read-only image or
+    //point-lookup index
+    void FreezeEnable() {}
+    void HashEnable(size_t) {}
+    bool freeze() { return false; }
+
+    const int max_level;
+
+protected:
+    //Bracket a change to a leaf that lookups may be reading. Writers of one
+    //leaf are serialized by its mutex or the exclusive index_lock.
+    static void writeBegin(NodeType* leaf)
+    {
+        leaf->version.store(leaf->version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    static void writeEnd(NodeType* leaf)
+    {
+        leaf->version.store(leaf->version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    //Leaf mutex or version held
+    static bool findIn(const NodeType* leaf, const K& key, V& outValue)
+    {
+        int pos = lowerBound(leaf, key);
+        if (pos < leaf->count && leaf->keys[pos] == key) {
+            outValue = leaf->values[pos];
+            return true;
+        }
+        return false;
+    }
+
+    //Position of the first key >= key (the count of keys < key)
+    static int lowerBound(const NodeType* leaf, const K& key)
+    {
+        if constexpr (std::is_same<K, long>::value && FAT_KEYS % 8 == 0) {
+#if defined(__AVX512F__)
+            __m512i k = _mm512_set1_epi64(key);
+            int pos = 0;
+            for (int i = 0; i < FAT_KEYS; i += 8) {
+                __m512i v = _mm512_load_si512((const void*)(leaf->keys + i));
+                pos += __builtin_popcount(_mm512_cmplt_epi64_mask(v, k));
+            }
+            return pos;
+#elif defined(__AVX2__)
+            __m256i k = _mm256_set1_epi64x(key);
+            int pos = 0;
+            for (int i = 0; i < FAT_KEYS; i += 4) {
+                __m256i v = _mm256_load_si256((const __m256i*)(leaf->keys + i));
+                pos += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v))));
+            }
+            return pos;
+#endif
+        }
+        int pos = 0;
+        while (pos < leaf->count && leaf->keys[pos] < key)
+            pos++;
+        return pos;
+    }
+
+    //Leaf whose range holds key; update[1..max_curr_level] get the last
+    //leaf at each level with low <= key. Without index_lock an unlink may
+    //clear a link, so each one is read once.
+    NodeType* findLeaf(const K& key, NodeType** update)
+    {
+        NodeType* currNode = m_pHeader;
+        for (int level = max_curr_level; level >= 1; level--) {
+            NodeType* next;
+            while ((next = currNode->forwards[level]) && !(key < next->low)) {
+                currNode = next;
+            }
+            if (update)
+                update[level] = currNode;
+        }
+        return currNode;
+    }
+
+    void insertAt(NodeType* leaf, int pos, K key, V value)
+    {
+        for (int i = leaf->count; i > pos; i--) {
+            leaf->keys[i] = std::move(leaf->keys[i-1]);
+            leaf->values[i] = std::move(leaf->values[i-1]);
+        }
+        leaf->keys[pos] = std::move(key);
+        leaf->values[pos] = std::move(value);
+        leaf->count++;
+        m_size.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //Moves the upper half of a full leaf into a new leaf linked after it.
+    //Exclusive lock held; update[] are the leaf's predecessors from findLeaf.
+    //The leaf's version stays odd, so lookups retry, until right is linked.
+    NodeType* split(NodeType* leaf, NodeType** update)
+    {
+        const int half = FAT_KEYS / 2;
+        pthread_mutex_lock(&leaf->lock);
+        writeBegin(leaf);
+        NodeType* right = new NodeType(leaf->keys[half], m_maxKey);
+        for (int i = half; i < FAT_KEYS; i++) {
+            right->keys[i - half] = std::move(leaf->keys[i]);
+            right->values[i - half] = std::move(leaf->values[i]);
+            leaf->keys[i] = m_maxKey;
+        }
+        right->count = FAT_KEYS - half;
+        leaf->count = half;
+
+        int newlevel = randomLevel();
+        for (int level = max_curr_level+1; level <= newlevel; level++) {
+            update[level] = m_pHeader;
+        }
+        if (newlevel > max_curr_level)
+            max_curr_level = newlevel;
+
+        //no fence lies between leaf's and right's, so the predecessors of
+        //the key are the predecessors of right as well
+        right->toplevel = newlevel;
+        for (int level = 1; level <= newlevel; level++) {
+            right->forwards[level] = update[level]->forwards[level];
+            update[level]->forwards[level] = right;
+        }
+        writeEnd(leaf);
+        pthread_mutex_unlock(&leaf->lock);
+        return right;
+    }
+
+    //Exclusive lock held: its range falls to the leaf before it. A lookup
+    //may still be on the way to it, so it is retired, not freed.
+    void unlink(NodeType* leaf)
+    {
+        pthread_mutex_lock(&leaf->lock);
+        writeBegin(leaf);
+        leaf->dead = true;
+        writeEnd(leaf);
+        pthread_mutex_unlock(&leaf->lock);
+        NodeType* currNode = m_pHeader;
+        for (int level = max_curr_level; level >= 1; level--) {
+            while (currNode->forwards[level] && currNode->forwards[level]->low < leaf->low) {
+                currNode = currNode->forwards[level];
+            }
+            if (level <= leaf->toplevel)
+                currNode->forwards[level] = leaf->forwards[level];
+        }
+        m_retired.push_back(leaf);
+        while (max_curr_level > 1 && m_pHeader->forwards[max_curr_level] == nullptr) {
+            max_curr_level--;
+        }
+    }
+
+    //Levels are only drawn by splits, which hold the exclusive lock
+    int randomLevel() {
+        int level = 1;
+        while ((m_rng = m_rng * 6364136223846793005UL + 1442695040888963407UL) >> 63 && level < MAXLEVEL) {
+            level++;
+        }
+        return level;
+    }
+
+    int max_curr_level;
+    K m_minKey;
+    K m_maxKey;
+    NodeType* m_pHeader;
+    std::atomic<long> m_size;
+    unsigned long m_rng = 0x9e3779b97f4a7c15UL;
+    std::vector<NodeType*> m_retired;       // unlinked leaves, exclusive lock
+    pthread_rwlock_t index_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+};
+
+#endif
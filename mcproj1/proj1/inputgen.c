@@ -1,65 +1,515 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include "trace.h"
 
 #define SPARSENESS 5
+#define MAX_PHASES 16
+#define BLOCK_OPS  (1L << 16)       // operations generated (and shuffled) per block
+#define ZETA_EXACT 1000000L         // Zipf normaliser terms summed exactly
 
-// A struct to hold a single operation (type and key)
+// Key distributions a phase can draw its operations from
+typedef enum {
+    DIST_UNIFORM,   // every preloaded key searched once, random odd inserts
+    DIST_ZIPF,      // searches/inserts skewed by a Zipf law (-z)
+    DIST_HOT,       // hot_ops% of searches/inserts hit a hot_keys% key range (-H)
+    DIST_SEQ,       // monotonically increasing keys
+    DIST_WINDOW     // sequential inserts, each delete removes the key inserted -w inserts ago
+} distribution;
+
+static const char* dist_names[] = { "uniform", "zipf", "hot", "seq", "window" };
+
+// One contiguous slice of the trace with its own mix and distribution
 typedef struct {
-    char type;
-    int key;
-} operation;
+    int share;      // percent of nqueries
+    int ins;        // insert percent
+    int del;        // delete percent
+    distribution dist;
+    long num_ops, num_inserts, num_deletes, num_searches;
+    long del_before, srch_before, seq_before;   // ordinals at the start of the phase
+    long win_before;                            // window inserts before the phase
+    long first_job, num_blocks;
+} phase;
+
+// Zipf sampler over ranks [0, n) (Gray et al., "Quickly generating
+// billion-record synthetic databases"). Rank 0 is the hottest.
+typedef struct {
+    long n;
+    double theta, alpha, zetan, eta, half_pow_theta;
+} zipf_gen;
+
+// Keyed bijection over [0, n) (4-round Feistel network with cycle walking),
+// used to visit key indices in random order without materialising them.
+typedef struct {
+    uint64_t n, mask;
+    int half_bits;
+    uint64_t keys[4];
+} permutation;
+
+// Counter-based RNG stream (splitmix64)
+typedef struct {
+    uint64_t state;
+} rng;
+
+/*
+ * Preloaded keys are never stored: search key j and delete key j are
+ * computed from j, one per bucket of the key space, so both families are
+ * sorted by index, spread over [0, nqueries^2), even and never equal to
+ * each other or to the odd insert keys.
+ */
+static long nqueries = 10;
+static long num_deletes, num_searches, search_family, preload_size;
+static int64_t search_width, delete_width;
+static int64_t seq_base;                // first sequential insert key
+static uint64_t seed;
+
+static phase phases[MAX_PHASES];
+static int nphases;
+static double zipf_theta = 0.99;
+static int hot_ops = 90;
+static int hot_keys = 10;
+static long window = 1000;
+static zipf_gen zipf_search, zipf_insert;
+static permutation perm_load, perm_delete, perm_search;
+
+static int binary_out = 0;
+static FILE *outfile;
+static int num_threads;
+static long preload_jobs, total_jobs;
+static char **out_bufs;
+static size_t *out_lens;
+static pthread_barrier_t round_barrier;
+
+static uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void rng_seed(rng *r, uint64_t stream) {
+    r->state = mix64(seed + 0x9e3779b97f4a7c15ULL * (stream + 1));
+}
+
+static uint64_t rng_next(rng *r) {
+    r->state += 0x9e3779b97f4a7c15ULL;
+    return mix64(r->state);
+}
 
 /**
- * @brief Shuffles an array of integers using the Fisher-Yates algorithm.
- * @param array The array to shuffle.
- * @param n The number of elements in the array.
+ * @brief Returns a uniform integer in [0, n).
  */
-void shuffle_int(int *array, size_t n) {
-    if (n > 1) {
-        for (size_t i = 0; i < n - 1; i++) {
-            size_t j = i + rand() / (RAND_MAX / (n - i) + 1);
-            int temp = array[j];
-            array[j] = array[i];
-            array[i] = temp;
+static uint64_t rng_below(rng *r, uint64_t n) {
+    return (uint64_t)(((unsigned __int128)rng_next(r) * n) >> 64);
+}
+
+/**
+ * @brief Returns a uniform double in [0, 1).
+ */
+static double rng_double(rng *r) {
+    return (rng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void perm_init(permutation *p, uint64_t n, uint64_t stream) {
+    int bits = 2;
+    while (bits < 64 && (1ULL << bits) < n) bits += 2;
+    p->n = n;
+    p->half_bits = bits / 2;
+    p->mask = (1ULL << p->half_bits) - 1;
+    for (int i = 0; i < 4; i++) {
+        p->keys[i] = mix64(seed ^ (stream * 4 + i + 1) * 0xd1b54a32d192ed03ULL);
+    }
+}
+
+static uint64_t perm_apply(const permutation *p, uint64_t x) {
+    do {
+        uint64_t l = x >> p->half_bits, r = x & p->mask;
+        for (int i = 0; i < 4; i++) {
+            uint64_t t = l ^ (mix64(r ^ p->keys[i]) & p->mask);
+            l = r;
+            r = t;
         }
+        x = (l << p->half_bits) | r;
+    } while (x >= p->n);
+    return x;
+}
+
+/**
+ * @brief Precomputes the constants of a Zipf sampler.
+ * @param z The sampler to initialise.
+ * @param n The number of ranks.
+ * @param theta The skew, 0 <= theta < 1 (0 is uniform).
+ *
+ * The first ZETA_EXACT terms of the normaliser are summed exactly and the
+ * tail is integrated (Euler-Maclaurin), so setup stays cheap for huge n.
+ */
+static void zipf_init(zipf_gen *z, long n, double theta) {
+    long m = n < ZETA_EXACT ? n : ZETA_EXACT;
+    double zeta2 = 0.0;
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0.0;
+    for (long i = 1; i <= m; i++) {
+        z->zetan += 1.0 / pow((double)i, theta);
+        if (i == 2) zeta2 = z->zetan;
     }
+    if (n > m) {
+        z->zetan += (pow((double)n, 1.0 - theta) - pow((double)m, 1.0 - theta)) / (1.0 - theta)
+                  + 0.5 * (pow((double)n, -theta) - pow((double)m, -theta));
+    }
+    if (n < 2) zeta2 = z->zetan;
+    z->alpha = 1.0 / (1.0 - theta);
+    z->half_pow_theta = pow(0.5, theta);
+    z->eta = (n < 2) ? 0.0 : (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
 }
 
 /**
- * @brief Shuffles an array of operation structs using the Fisher-Yates algorithm.
+ * @brief Draws a rank from a Zipf sampler.
+ * @param z The sampler.
+ * @return A rank in [0, n).
+ */
+static long zipf_next(const zipf_gen *z, rng *r) {
+    double u = rng_double(r);
+    double uz = u * z->zetan;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + z->half_pow_theta) return 1 < z->n ? 1 : 0;
+    long k = (long)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return k < z->n ? k : z->n - 1;
+}
+
+/**
+ * @brief Picks an index in [0, n) where hot_ops% of picks land in the first
+ *        hot_keys% of the range.
+ */
+static long hot_index(long n, rng *r) {
+    long hot_n = (long)(n * (hot_keys / 100.0));
+    if (hot_n < 1) hot_n = 1;
+    if (hot_n >= n || (int)rng_below(r, 100) < hot_ops) {
+        return (long)rng_below(r, hot_n);
+    }
+    return hot_n + (long)rng_below(r, n - hot_n);
+}
+
+/**
+ * @brief Shuffles an array of operation types using the Fisher-Yates algorithm.
  * @param array The array to shuffle.
  * @param n The number of elements in the array.
  */
-void shuffle_op(operation *array, size_t n) {
-    if (n > 1) {
-        for (size_t i = 0; i < n - 1; i++) {
-            size_t j = i + rand() / (RAND_MAX / (n - i) + 1);
-            operation temp = array[j];
-            array[j] = array[i];
-            array[i] = temp;
+static void shuffle_types(char *array, long n, rng *r) {
+    for (long i = n - 1; i > 0; i--) {
+        long j = (long)rng_below(r, i + 1);
+        char temp = array[j];
+        array[j] = array[i];
+        array[i] = temp;
+    }
+}
+
+static int64_t search_key(long j) {
+    return 4 * (j * search_width + (int64_t)(mix64(seed ^ (uint64_t)j) % search_width));
+}
+
+static int64_t delete_key(long j) {
+    return 4 * (j * delete_width + (int64_t)(mix64(~seed ^ (uint64_t)j) % delete_width)) + 2;
+}
+
+/**
+ * @brief Number of the total items that fall before position pos when
+ *        total items are spread evenly over n positions.
+ */
+static long spread(long total, long n, long pos) {
+    return (long)((__int128)total * pos / n);
+}
+
+static char *emit(char *out, char type, int64_t key) {
+    if (binary_out) {
+        trace_record rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.key = key;
+        rec.type = type;
+        memcpy(out, &rec, sizeof(rec));
+        return out + sizeof(rec);
+    }
+    char digits[24];
+    int nd = 0;
+    uint64_t v = (uint64_t)key;
+    do {
+        digits[nd++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    *out++ = type;
+    *out++ = ' ';
+    while (nd) *out++ = digits[--nd];
+    *out++ = '\n';
+    return out;
+}
+
+/**
+ * @brief Writes preload block c (the "i" lines before the workload).
+ */
+static size_t gen_preload(long c, char *out) {
+    char *p = out;
+    long lo = c * BLOCK_OPS;
+    long hi = lo + BLOCK_OPS < preload_size ? lo + BLOCK_OPS : preload_size;
+    for (long i = lo; i < hi; i++) {
+        long it = (long)perm_apply(&perm_load, i);
+        p = emit(p, 'i', it < search_family ? search_key(it) : delete_key(it - search_family));
+    }
+    return p - out;
+}
+
+/**
+ * @brief Number of inserts among the first pos ops of a phase: every block
+ *        gets its spread() share of deletes and searches, the rest insert.
+ */
+static long inserts_before(const phase *ph, long pos) {
+    return pos - spread(ph->num_deletes, ph->num_ops, pos) - spread(ph->num_searches, ph->num_ops, pos);
+}
+
+/**
+ * @brief Fills types with the shuffled op mix of block c of a phase, from
+ *        a generator seeded for that block. Returns the block's op count.
+ */
+static long block_types(const phase *ph, long c, char *types, rng *r) {
+    long lo = c * BLOCK_OPS;
+    long hi = lo + BLOCK_OPS < ph->num_ops ? lo + BLOCK_OPS : ph->num_ops;
+    long n_del = spread(ph->num_deletes, ph->num_ops, hi) - spread(ph->num_deletes, ph->num_ops, lo);
+    long n_srch = spread(ph->num_searches, ph->num_ops, hi) - spread(ph->num_searches, ph->num_ops, lo);
+    long n = hi - lo, k = 0;
+
+    rng_seed(r, ph->first_job + c);
+    for (long i = 0; i < n_del; i++) types[k++] = 'd';
+    for (long i = 0; i < n_srch; i++) types[k++] = 'q';
+    while (k < n) types[k++] = 'i';
+    shuffle_types(types, n, r);
+    return n;
+}
+
+/**
+ * @brief Key of the w-th insert over all window phases.
+ */
+static int64_t window_key(long w) {
+    int p = 0;
+    while (phases[p].dist != DIST_WINDOW || w >= phases[p].win_before + phases[p].num_inserts) p++;
+    return seq_base + 2 * (phases[p].seq_before + w - phases[p].win_before);
+}
+
+/**
+ * @brief Whether the window is full at the start of block c of phase p.
+ *
+ * Like a ring of the last -w window inserts: each insert refills it, and
+ * a delete while it is full removes the oldest entry, so at most one
+ * window delete follows each insert and further deletes use preloaded
+ * keys. The window is therefore full (given -w inserts so far) exactly
+ * when the last insert or delete of the window phases before the block was
+ * an insert. That op is found by replaying the earlier blocks' shuffles.
+ */
+static int window_armed(int p, long c, char *types) {
+    rng r;
+    for (;;) {
+        while (c == 0) {
+            if (--p < 0) return 0;
+            c = phases[p].dist == DIST_WINDOW ? phases[p].num_blocks : 0;
+        }
+        c--;
+        for (long i = block_types(&phases[p], c, types, &r) - 1; i >= 0; i--) {
+            if (types[i] != 'q') return types[i] == 'i';
+        }
+    }
+}
+
+/**
+ * @brief Writes block c of a phase. Only the op mix inside the block is
+ *        shuffled; keys are drawn afterwards in trace order, from ordinals
+ *        that depend only on the block position, so blocks are independent.
+ */
+static size_t gen_block(const phase *ph, long c, char *types, char *out, rng *r) {
+    char *p = out;
+    long lo = c * BLOCK_OPS;
+
+    // ordinals of the first delete, search, sequential and window insert of
+    // this block, counted as the earlier blocks issued them
+    long d = ph->del_before + spread(ph->num_deletes, ph->num_ops, lo);
+    long q = ph->srch_before + spread(ph->num_searches, ph->num_ops, lo);
+    long s = ph->seq_before;
+    long w = ph->win_before;
+    int sequential = ph->dist == DIST_SEQ || ph->dist == DIST_WINDOW;
+    if (sequential) s += inserts_before(ph, lo);
+    int armed = 0;
+    if (ph->dist == DIST_WINDOW) {
+        w += inserts_before(ph, lo);
+        armed = window_armed((int)(ph - phases), c, types);
+    }
+
+    long n = block_types(ph, c, types, r);
+
+    for (long i = 0; i < n; i++) {
+        int64_t key;
+        if (types[i] == 'd') {
+            if (ph->dist == DIST_WINDOW && armed && w >= window) {
+                key = window_key(w - window);
+                armed = 0;
+            } else {
+                key = delete_key((long)perm_apply(&perm_delete, d));
+            }
+            d++;
+        } else if (types[i] == 'q') {
+            switch (ph->dist) {
+                case DIST_ZIPF:
+                    key = search_key((long)perm_apply(&perm_search, zipf_next(&zipf_search, r)));
+                    break;
+                case DIST_HOT:
+                    key = search_key(hot_index(num_searches, r));
+                    break;
+                case DIST_SEQ:
+                    key = search_key(q % num_searches);
+                    break;
+                default:
+                    key = search_key((long)perm_apply(&perm_search, q % num_searches));
+                    break;
+            }
+            q++;
+        } else {
+            switch (ph->dist) {
+                case DIST_ZIPF:
+                    key = zipf_next(&zipf_insert, r) * 2 + 1;
+                    break;
+                case DIST_HOT:
+                    key = hot_index(nqueries * SPARSENESS, r) * 2 + 1;
+                    break;
+                case DIST_SEQ:
+                    key = seq_base + 2 * s++;
+                    break;
+                case DIST_WINDOW:
+                    key = seq_base + 2 * s++;
+                    w++;
+                    armed = 1;
+                    break;
+                default:
+                    // New, non-conflicting odd-numbered keys
+                    key = (int64_t)rng_below(r, nqueries * SPARSENESS) * 2 + 1;
+                    break;
+            }
+        }
+        p = emit(p, types[i], key);
+    }
+    return p - out;
+}
+
+/**
+ * @brief Generates jobs t, t+T, t+2T, ... Each round every thread fills its
+ *        own buffer, then thread 0 writes the buffers out in job order.
+ */
+static void *gen_worker(void *arg) {
+    int t = *(int*)arg;
+    char *types = (char*)malloc(BLOCK_OPS);
+    rng r;
+
+    for (long base = 0; base < total_jobs; base += num_threads) {
+        long job = base + t;
+        out_lens[t] = 0;
+        if (job < preload_jobs) {
+            out_lens[t] = gen_preload(job, out_bufs[t]);
+        } else if (job < total_jobs) {
+            int p = 0;
+            while (p + 1 < nphases && job >= phases[p + 1].first_job) p++;
+            out_lens[t] = gen_block(&phases[p], job - phases[p].first_job, types, out_bufs[t], &r);
+        }
+        pthread_barrier_wait(&round_barrier);
+        if (t == 0) {
+            for (int i = 0; i < num_threads; i++) {
+                if (out_lens[i] > 0 && fwrite(out_bufs[i], 1, out_lens[i], outfile) != out_lens[i]) {
+                    perror("fwrite");
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        pthread_barrier_wait(&round_barrier);
+    }
+
+    free(types);
+    return NULL;
+}
+
+/**
+ * @brief Parses a distribution name.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+static int parse_dist(const char *name, distribution *out) {
+    for (int d = 0; d < (int)(sizeof(dist_names) / sizeof(dist_names[0])); d++) {
+        if (strcmp(name, dist_names[d]) == 0) {
+            *out = (distribution)d;
+            return 0;
         }
     }
+    return -1;
+}
+
+/**
+ * @brief Parses a phase list "share:ins:del[:dist],share:ins:del[:dist],...".
+ * @return The number of phases, or -1 on a malformed spec.
+ */
+static int parse_phases(char *spec, distribution default_dist) {
+    int n = 0;
+    for (char *tok = strtok(spec, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        char name[32] = "";
+        if (n == MAX_PHASES) return -1;
+        int got = sscanf(tok, "%d:%d:%d:%31s", &phases[n].share, &phases[n].ins, &phases[n].del, name);
+        if (got < 3) return -1;
+        phases[n].dist = default_dist;
+        if (got == 4 && parse_dist(name, &phases[n].dist) != 0) return -1;
+        n++;
+    }
+    return n;
 }
 
 int main(int argc, char** argv) {
-    srand(time(NULL));
     int opt;
-    int nqueries = 10;
     int ins_proportion = 40;
     int del_proportion = 20;
+    distribution dist = DIST_UNIFORM;
+    char *phase_spec = NULL;
+    const char *outname = NULL;
     extern char* optarg;
 
+    seed = (uint64_t)time(NULL);
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
     const char* usage = "Usage: %s -n {queries (>10)} -i {insert %%} -d {delete %%}\n"
-                        "Search proportion is calculated as 100 - insert%% - delete%%\n";
+                        "          [-k uniform|zipf|hot|seq|window] [-z {zipf theta}] [-H {hot ops%%}:{hot keys%%}]\n"
+                        "          [-w {window}] [-p {share%%}:{ins%%}:{del%%}[:{dist}],...] [-s {seed}]\n"
+                        "          [-t {threads}] [-o {outfile}] [-b]\n"
+                        "Search proportion is calculated as 100 - insert%% - delete%%\n"
+                        "Writes to stdout unless -o is given; -b writes the binary trace format\n";
 
     // --- Argument Parsing ---
-    while ((opt = getopt(argc, argv, "n:i:d:")) != -1) {
+    while ((opt = getopt(argc, argv, "n:i:d:k:z:H:w:p:s:t:o:b")) != -1) {
         switch (opt) {
-            case 'n': nqueries = atoi(optarg); break;
+            case 'n': nqueries = atol(optarg); break;
             case 'i': ins_proportion = atoi(optarg); break;
             case 'd': del_proportion = atoi(optarg); break;
+            case 'k':
+                if (parse_dist(optarg, &dist) != 0) {
+                    fprintf(stderr, "Error: unknown distribution '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'z': zipf_theta = atof(optarg); break;
+            case 'H':
+                if (sscanf(optarg, "%d:%d", &hot_ops, &hot_keys) != 2) {
+                    fprintf(stderr, usage, argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w': window = atol(optarg); break;
+            case 'p': phase_spec = optarg; break;
+            case 's': seed = strtoull(optarg, NULL, 10); break;
+            case 't': num_threads = atoi(optarg); break;
+            case 'o': outname = optarg; break;
+            case 'b': binary_out = 1; break;
             default:
                 fprintf(stderr, usage, argv[0]);
                 exit(EXIT_FAILURE);
@@ -73,92 +523,176 @@ int main(int argc, char** argv) {
         exit(EXIT_FAILURE);
     }
 
-    if (ins_proportion + del_proportion > 100) {
-        fprintf(stderr, "Error: insert%% + delete%% must be <= 100\n");
+    if (nqueries > 3000000000L) {
+        fprintf(stderr, "Error: Number of queries (-n) must be at most 3000000000.\n");
         exit(EXIT_FAILURE);
     }
 
-    // --- File Handling: Open the output file in write mode ---
-    FILE *outfile = fopen("workload.txt", "w");
-    if (outfile == NULL) {
-        perror("Error opening output file");
+    if (zipf_theta < 0.0 || zipf_theta >= 1.0) {
+        fprintf(stderr, "Error: zipf theta (-z) must be in [0, 1)\n");
         exit(EXIT_FAILURE);
     }
 
-    // --- Calculate Operation Counts ---
-    int search_proportion = 100 - ins_proportion - del_proportion;
-    int num_inserts = (int)((nqueries * ins_proportion) / 100.0);
-    int num_deletes = (int)((nqueries * del_proportion) / 100.0);
-    int num_searches = nqueries - num_inserts - num_deletes;
+    if (hot_ops < 0 || hot_ops > 100 || hot_keys <= 0 || hot_keys > 100) {
+        fprintf(stderr, "Error: hot spec (-H) must be {0..100}:{1..100}\n");
+        exit(EXIT_FAILURE);
+    }
 
-    int preload_size = num_deletes + num_searches;
-    if (preload_size == 0) {
-         preload_size = nqueries / 2;
+    if (window < 1) {
+        fprintf(stderr, "Error: window (-w) must be >= 1\n");
+        exit(EXIT_FAILURE);
     }
 
-    // --- Key Space Generation & Load Phase ---
-    int* preloaded_keys = (int*)malloc(preload_size * sizeof(int));
-    if (preloaded_keys == NULL) {
-        perror("Failed to allocate memory for preloaded_keys");
-        fclose(outfile); // Close file before exiting
+    if (num_threads < 1) {
+        fprintf(stderr, "Error: threads (-t) must be >= 1\n");
         exit(EXIT_FAILURE);
     }
-    
-    // Generate initial random keys
-    for (int i = 0; i < preload_size; i++) {
-        preloaded_keys[i] = rand() % (nqueries * nqueries);
+
+    if (phase_spec == NULL) {
+        phases[0] = (phase){ .share = 100, .ins = ins_proportion, .del = del_proportion, .dist = dist };
+        nphases = 1;
+    } else {
+        nphases = parse_phases(phase_spec, dist);
+        if (nphases <= 0) {
+            fprintf(stderr, "Error: malformed phase list (-p)\n");
+            fprintf(stderr, usage, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int share_sum = 0;
+    for (int p = 0; p < nphases; p++) {
+        if (phases[p].share <= 0 || phases[p].ins < 0 || phases[p].del < 0 ||
+            phases[p].ins + phases[p].del > 100) {
+            fprintf(stderr, "Error: insert%% + delete%% must be <= 100\n");
+            exit(EXIT_FAILURE);
+        }
+        share_sum += phases[p].share;
+    }
+    if (share_sum != 100) {
+        fprintf(stderr, "Error: phase shares must add up to 100\n");
+        exit(EXIT_FAILURE);
     }
 
-    // Write the initial load operations to the file
-    for (int i = 0; i < preload_size; i++) {
-        fprintf(outfile, "i %d\n", preloaded_keys[i]);
+    // --- File Handling: stdout unless a file name was given ---
+    if (outname == NULL) {
+        outfile = stdout;
+    } else {
+        outfile = fopen(outname, binary_out ? "wb" : "w");
+        if (outfile == NULL) {
+            perror("Error opening output file");
+            exit(EXIT_FAILURE);
+        }
     }
+    setvbuf(outfile, NULL, _IOFBF, 1 << 22);
 
-    // Shuffle keys to randomize which ones are for deletion vs. searching
-    shuffle_int(preloaded_keys, preload_size);
+    // --- Calculate Operation Counts ---
+    long assigned = 0, seq_inserts = 0, win_inserts = 0;
+    int need_zipf = 0;
+    for (int p = 0; p < nphases; p++) {
+        phase *ph = &phases[p];
+        ph->num_ops = (p == nphases - 1) ? nqueries - assigned
+                                         : (long)((nqueries * ph->share) / 100.0);
+        assigned += ph->num_ops;
+        ph->num_inserts = (long)((ph->num_ops * ph->ins) / 100.0);
+        ph->num_deletes = (long)((ph->num_ops * ph->del) / 100.0);
+        ph->num_searches = ph->num_ops - ph->num_inserts - ph->num_deletes;
+        ph->del_before = num_deletes;
+        ph->srch_before = num_searches;
+        ph->seq_before = seq_inserts;
+        ph->win_before = win_inserts;
+        num_deletes += ph->num_deletes;
+        num_searches += ph->num_searches;
+        if (ph->dist == DIST_SEQ || ph->dist == DIST_WINDOW) seq_inserts += ph->num_inserts;
+        if (ph->dist == DIST_WINDOW) win_inserts += ph->num_inserts;
+        if (ph->dist == DIST_ZIPF) need_zipf = 1;
+    }
 
-    // --- Workload Definition ---
-    operation* workload = (operation*)malloc(nqueries * sizeof(operation));
-    if (workload == NULL) {
-        perror("Failed to allocate memory for workload");
-        free(preloaded_keys);
-        fclose(outfile); // Close file before exiting
-        exit(EXIT_FAILURE);
+    preload_size = num_deletes + num_searches;
+    if (preload_size == 0) {
+         preload_size = nqueries / 2;
     }
+    search_family = preload_size - num_deletes;
 
-    int op_idx = 0;
+    // --- Key Space: each family gets its own buckets of [0, nqueries^2) ---
+    int64_t key_space = (int64_t)nqueries * nqueries;
+    search_width = search_family > 0 ? key_space / 4 / search_family : 1;
+    delete_width = num_deletes > 0 ? key_space / 4 / num_deletes : 1;
+    if (search_width < 1) search_width = 1;
+    if (delete_width < 1) delete_width = 1;
+    seq_base = (key_space | 1) + 2;
 
-    // Create delete operations from the first part of the shuffled array
-    for (int i = 0; i < num_deletes; i++) {
-        workload[op_idx++] = (operation){'d', preloaded_keys[i]};
+    perm_init(&perm_load, preload_size, 0);
+    perm_init(&perm_delete, num_deletes, 1);
+    perm_init(&perm_search, num_searches, 2);
+    if (need_zipf) {
+        if (num_searches > 0) zipf_init(&zipf_search, num_searches, zipf_theta);
+        zipf_init(&zipf_insert, nqueries * SPARSENESS, zipf_theta);
     }
 
-    // Create search operations from the second, non-overlapping part
-    for (int i = 0; i < num_searches; i++) {
-        workload[op_idx++] = (operation){'q', preloaded_keys[num_deletes + i]};
+    // --- Job Layout: preload blocks first, then every phase's blocks ---
+    preload_jobs = (preload_size + BLOCK_OPS - 1) / BLOCK_OPS;
+    total_jobs = preload_jobs;
+    for (int p = 0; p < nphases; p++) {
+        phases[p].first_job = total_jobs;
+        phases[p].num_blocks = (phases[p].num_ops + BLOCK_OPS - 1) / BLOCK_OPS;
+        total_jobs += phases[p].num_blocks;
     }
 
-    // Create insert operations using new, non-conflicting odd-numbered keys
-    for (int i = 0; i < num_inserts; i++) {
-        int new_key = (rand() % (nqueries * SPARSENESS)) * 2 + 1;
-        workload[op_idx++] = (operation){'i', new_key};
+    if (binary_out) {
+        trace_header hdr;
+        memcpy(hdr.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+        hdr.count = (uint64_t)(preload_size + nqueries);
+        fwrite(&hdr, sizeof(hdr), 1, outfile);
     }
 
-    // Shuffle the entire list of operations to create a random workload
-    shuffle_op(workload, nqueries);
+    // --- Parallel Generation ---
+    size_t buf_size = BLOCK_OPS * (binary_out ? sizeof(trace_record) : 24);
+    pthread_t *threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+    int *tids = (int*)malloc(num_threads * sizeof(int));
+    out_bufs = (char**)malloc(num_threads * sizeof(char*));
+    out_lens = (size_t*)malloc(num_threads * sizeof(size_t));
+    if (threads == NULL || tids == NULL || out_bufs == NULL || out_lens == NULL) {
+        perror("Failed to allocate memory for workers");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        out_bufs[i] = (char*)malloc(buf_size);
+        if (out_bufs[i] == NULL) {
+            perror("Failed to allocate memory for output buffers");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    // --- Workload Execution: Write the final workload to the file ---
-    for (int i = 0; i < nqueries; i++) {
-        fprintf(outfile, "%c %d\n", workload[i].type, workload[i].key);
+    pthread_barrier_init(&round_barrier, NULL, num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        tids[i] = i;
+        if (pthread_create(&threads[i], NULL, gen_worker, &tids[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
     }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&round_barrier);
 
     // --- Cleanup ---
-    free(preloaded_keys);
-    free(workload);
-    fclose(outfile); // Close the file to ensure all data is saved
+    for (int i = 0; i < num_threads; i++) {
+        free(out_bufs[i]);
+    }
+    free(out_bufs);
+    free(out_lens);
+    free(threads);
+    free(tids);
+    if (fflush(outfile) != 0 || (outfile != stdout && fclose(outfile) != 0)) {
+        perror("Error writing output");
+        exit(EXIT_FAILURE);
+    }
 
     // Print a confirmation message to the terminal
-    printf("Workload successfully saved to workload.txt\n");
+    fprintf(stderr, "Workload of %ld ops (+%ld preload) written to %s (seed %llu)\n",
+            nqueries, preload_size, outname ? outname : "stdout", (unsigned long long)seed);
 
     return 0;
 }
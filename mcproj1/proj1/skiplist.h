@@ -1,30 +1,88 @@
+#ifndef SKIPLIST_H
+#define SKIPLIST_H
+
 #include <iostream>
 #include <sstream>
 #include <cstdlib>
+#include <cstdint>
 #include <ctime>
 #include <pthread.h>
 #include <queue>
 #include <vector>
+#include <string>
+#include <utility>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <type_traits>
+#include <functional>
+#include <limits>
+#include <sched.h>
 
 #define BILLION  1000000000L
+#define POOL_CHUNK  (1 << 20)   // bytes a thread's node pool grows by
+#define FIND_GROUP  16          // lookups find_many keeps in flight
+#define FREEZE_MIN  4096        // write-free lookups a thread makes before freezing
+#define TUNE_INTERVAL 1024      // writes a thread makes between level retunes
+#ifndef INLINE_LEVELS
+#define INLINE_LEVELS 2         // lowest levels whose successor keys a node copies
+#endif
 
 using namespace std;
 
 extern int thread_sz;
 
-struct Work{
-        long key;
-        char action;
+//Key comparisons used during traversal. Scalar keys compare directly and
+//carry a dummy prefix. Integer keys are also copied into each node next to
+//its forward pointers (inline_keys), so find can compare against a
+//successor without loading it.
+template<class K>
+struct skiplist_key_traits
+{
+    typedef char prefix_type;
+    static const bool inline_keys = std::is_integral<K>::value;
+
+    static prefix_type prefix(const K&) { return 0; }
+    static bool less(const K& a, prefix_type, const K& b, prefix_type) { return a < b; }
+    static bool equal(const K& a, prefix_type, const K& b, prefix_type) { return a == b; }
 };
 
-//Define the Worker Queue & Skiplist
-vector<queue<Work>> WorkQueue;
+//String keys cache their first 8 bytes big-endian (zero padded), so most
+//comparisons are one integer compare that never touches the string buffer.
+template<>
+struct skiplist_key_traits<std::string>
+{
+    typedef uint64_t prefix_type;
+    static const bool inline_keys = false;
 
+    static prefix_type prefix(const std::string& key)
+    {
+	prefix_type p = 0;
+	size_t n = key.size() < 8 ? key.size() : 8;
+	for (size_t i = 0; i < 8; i++)
+	    p = (p << 8) | (i < n ? (unsigned char)key[i] : 0);
+	return p;
+    }
+    static bool less(const std::string& a, prefix_type pa, const std::string& b, prefix_type pb)
+    {
+	return pa != pb ? pa < pb : a < b;
+    }
+    static bool equal(const std::string& a, prefix_type pa, const std::string& b, prefix_type pb)
+    {
+	return pa == pb && a == b;
+    }
+};
 
+//Nodes start on a cache line, and the fields a lookup reads come first:
+//with 8-byte keys, the inline successor keys, key and forwards[0..4] fill
+//exactly the first line. Nothing derives from a node, so it has no vtable.
 template<class K,class V,int MAXLEVEL>
-class skiplist_node
+class alignas(64) skiplist_node
 {
 public:
+    typedef typename std::conditional<skiplist_key_traits<K>::inline_keys, K, char>::type NextKeyType;
+
     skiplist_node()
     {
 	mark = false;
@@ -34,8 +92,12 @@ public:
         }
     }
 
-    skiplist_node(K searchKey):key(searchKey)
+    skiplist_node(K searchKey):key(std::move(searchKey))
     {
+	prefix = skiplist_key_traits<K>::prefix(key);
+	insert_version = NO_VERSION;
+	erase_version = NO_VERSION;
+	seen_version = NO_VERSION;
 	mark = false;
 	valid = false;
         for (int i = 1; i <= MAXLEVEL; i++) {
@@ -43,8 +105,13 @@ public:
         }
     }
 
-    skiplist_node(K searchKey,V val):key(searchKey),value(val)
+    //key and value are moved in, so callers passing rvalues never copy them
+    skiplist_node(K searchKey,V val):key(std::move(searchKey)),value(std::move(val))
     {
+	prefix = skiplist_key_traits<K>::prefix(key);
+	insert_version = NO_VERSION;
+	erase_version = NO_VERSION;
+	seen_version = NO_VERSION;
 	mark = false;
 	valid = false;
         for (int i = 1; i <= MAXLEVEL; i++) {
@@ -52,23 +119,187 @@ public:
         }
     }
 
-    virtual ~skiplist_node()
+    ~skiplist_node()
     {
     }
 
+    //Copy of forwards[lv]->key for lv <= INLINE_LEVELS (inline_keys only),
+    //stored highest level first
+    NextKeyType& nextKey(int lv) { return next_keys[INLINE_LEVELS - lv]; }
+    const NextKeyType& nextKey(int lv) const { return next_keys[INLINE_LEVELS - lv]; }
+
+    NextKeyType next_keys[INLINE_LEVELS] = {};
     K key;
-    V value;
     skiplist_node<K,V,MAXLEVEL>* forwards[MAXLEVEL+1];
+    V value;
+
+    typename skiplist_key_traits<K>::prefix_type prefix;
 
-    bool mark;
+    //Snapshot stamps: a node is in snapshot v iff insert_version <= v < erase_version
+    static const uint64_t NO_VERSION = UINT64_MAX;
+    std::atomic<uint64_t> insert_version;
+    std::atomic<uint64_t> erase_version;
+    std::atomic<uint64_t> seen_version;     // last snapshot walk that emitted it
+
+    //atomic: erase waits on valid and inserts check mark without the node's lock
+    std::atomic<bool> mark;
     int toplevel;
-    bool valid;
+    std::atomic<bool> valid;
+    bool pooled = false;    // carved from a thread pool, not new'd
     pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
 };
 
+//Immutable copy of the list for write-free phases: the keys and values in
+//Eytzinger (BFS) order, 1-based, so a lookup is a branch-free descent of an
+//implicit binary tree whose next few levels sit in the line it prefetches.
+template<class K,class V>
+class skiplist_frozen
+{
+public:
+    //sorted holds the keys and values in ascending key order
+    explicit skiplist_frozen(std::vector<std::pair<K,V>>& sorted)
+        : n(sorted.size()), keys(n + 1), values(n + 1)
+    {
+	size_t next = 0;
+	fill(sorted, next, 1);
+    }
+
+    bool find(const K& searchKey, V& outValue) const
+    {
+	size_t k = 1;
+	while (k <= n) {
+	    if (8 * k <= n)
+		__builtin_prefetch(&keys[8 * k]);
+	    k = 2 * k + (keys[k] < searchKey);
+	}
+	//strip the trailing right turns (and the one left turn before them)
+	k >>= __builtin_ffsl(~k);
+	if (k != 0 && keys[k] == searchKey) {
+	    outValue = values[k];
+	    return true;
+	}
+	return false;
+    }
+
+    size_t size() const { return n; }
+
+private:
+    //In-order walk of the implicit tree rooted at k
+    void fill(std::vector<std::pair<K,V>>& sorted, size_t& next, size_t k)
+    {
+	if (k > n)
+	    return;
+	fill(sorted, next, 2 * k);
+	keys[k] = std::move(sorted[next].first);
+	values[k] = std::move(sorted[next].second);
+	next++;
+	fill(sorted, next, 2 * k + 1);
+    }
+
+    size_t n;
+    std::vector<K> keys;
+    std::vector<V> values;
+};
+
+//Open-addressing (linear probing) index from key to live node, kept next
+//to the list for point lookups. Slots only ever go empty -> node or
+//tombstone <-> node, never back to empty, so a probe may stop at the first
+//empty slot. The key is read from the node, and nodes that are marked or
+//not yet valid do not count as present.
+template<class K,class V,int MAXLEVEL>
+class skiplist_hash
+{
+public:
+    typedef skiplist_node<K,V,MAXLEVEL> NodeType;
+
+    //Room for about expected keys at a load factor of at most 1/2
+    explicit skiplist_hash(size_t expected) : overflow(false)
+    {
+	capacity = 1024;
+	while (capacity < 2 * expected)
+	    capacity <<= 1;
+	mask = capacity - 1;
+	table.reset(new std::atomic<NodeType*>[capacity]);
+	for (size_t i = 0; i < capacity; i++)
+	    table[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    //Claims the first empty or tombstone slot in node->key's probe sequence
+    void insert(NodeType* node)
+    {
+	size_t i = slot(node->key);
+	for (size_t probes = 0; probes < capacity; probes++, i = (i + 1) & mask) {
+	    NodeType* cur = table[i].load(std::memory_order_relaxed);
+	    if ((cur == nullptr || cur == tombstone()) &&
+		table[i].compare_exchange_strong(cur, node))
+		return;
+	}
+	overflow.store(true);
+    }
+
+    void erase(NodeType* node)
+    {
+	size_t i = slot(node->key);
+	for (size_t probes = 0; probes < capacity; probes++, i = (i + 1) & mask) {
+	    NodeType* cur = table[i].load(std::memory_order_relaxed);
+	    if (cur == nullptr)
+		return;
+	    if (cur == node) {
+		table[i].compare_exchange_strong(cur, tombstone());
+		return;
+	    }
+	}
+    }
+
+    NodeType* find(const K& key) const
+    {
+	size_t i = slot(key);
+	for (size_t probes = 0; probes < capacity; probes++, i = (i + 1) & mask) {
+	    NodeType* cur = table[i].load(std::memory_order_acquire);
+	    if (cur == nullptr)
+		return nullptr;
+	    if (cur != tombstone() && cur->key == key && cur->valid && !cur->mark)
+		return cur;
+	}
+	return nullptr;
+    }
+
+    void prefetch(const K& key) const
+    {
+	__builtin_prefetch(&table[slot(key)]);
+    }
+
+    //Some node did not fit, so a miss here proves nothing
+    bool overflowed() const { return overflow.load(std::memory_order_relaxed); }
+
+private:
+    static NodeType* tombstone() { return reinterpret_cast<NodeType*>(1); }
+
+    size_t slot(const K& key) const
+    {
+	uint64_t h = std::hash<K>()(key) * 0x9E3779B97F4A7C15ULL;
+	return (h ^ (h >> 32)) & mask;
+    }
+
+    size_t capacity;
+    size_t mask;
+    std::unique_ptr<std::atomic<NodeType*>[]> table;
+    std::atomic<bool> overflow;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 
+//MAXLEVEL for a list expected to hold about n keys: log2(n) levels keep the
+//top level at O(1) nodes with p = 1/2. Kept within [4, 32].
+constexpr int skiplist_levels(unsigned long n)
+{
+    int levels = 1;
+    while (levels < 32 && (1UL << levels) < n)
+        levels++;
+    return levels < 4 ? 4 : levels;
+}
+
 template<class K, class V, int MAXLEVEL = 16>
 class skiplist
 {
@@ -76,65 +307,160 @@ public:
     typedef K KeyType;
     typedef V ValueType;
     typedef skiplist_node<K,V,MAXLEVEL> NodeType;
+    typedef skiplist_frozen<K,V> FrozenType;
+    typedef skiplist_hash<K,V,MAXLEVEL> HashType;
+    typedef skiplist_key_traits<K> Traits;
+    typedef typename Traits::prefix_type PrefixType;
+
+    //Integer keys take the sentinels from the type's own range
+    template<class T = K, class = typename std::enable_if<std::is_integral<T>::value>::type>
+    skiplist():skiplist(std::numeric_limits<K>::min(), std::numeric_limits<K>::max())
+    {
+    }
 
     skiplist(K minKey,K maxKey):m_pHeader(nullptr),m_pTail(nullptr),
-                                max_curr_level(1),max_level(MAXLEVEL),
-                                m_minKey(minKey),m_maxKey(maxKey)
+                                max_curr_level(1),
+                                m_minKey(minKey),m_maxKey(maxKey),
+                                m_version(0),m_snapshots(0),m_frozen(nullptr)
     {
+        TrashSet();
         m_pHeader = new NodeType(m_minKey);
         m_pTail   = new NodeType(m_maxKey);
 	m_pHeader->valid = true;
 	m_pTail->valid = true;
         for (int i = 1; i <= MAXLEVEL; i++) {
-            m_pHeader->forwards[i] = m_pTail;
+            link(m_pHeader, i, m_pTail);
         }
     }
 
-    virtual ~skiplist()
+    ~skiplist()
     {
         NodeType* currNode = m_pHeader->forwards[1];
         while (currNode != m_pTail) {
             NodeType* tempNode = currNode;
             currNode = currNode->forwards[1];
-            delete tempNode;
+            freeNode(tempNode);
         }
         delete m_pHeader;
         delete m_pTail;
+        delete m_frozen.load();
+        for (FrozenType* frozen : m_frozen_retired)
+            delete frozen;
+        for (int i = 0; i < m_numSlots; i++)
+            for (void* chunk : m_slots[i].pool_chunks)
+                free(chunk);
     }
 
     void insert(K searchKey,V newValue)
     {
         skiplist_node<K,V,MAXLEVEL>* update[MAXLEVEL+1];
         NodeType* currNode = m_pHeader;
+        PrefixType searchPrefix = Traits::prefix(searchKey);
+        int top = max_curr_level;
 
         // find predecessor 
-        for (int level = max_curr_level; level >= 1; level--) {
-            while (currNode->forwards[level]->key < searchKey && currNode->forwards[level]->valid) {
-                currNode = currNode->forwards[level];
+        for (int level = top; level >= 1; level--) {
+            //forwards[level] is read once per step: an erase may swing it
+            //to the tail between a second read and the compare
+            NodeType* next;
+            while (keyLess(next = currNode->forwards[level], searchKey, searchPrefix) && next->valid) {
+                currNode = next;
             }
             update[level] = currNode;
         }
-        currNode = currNode->forwards[1];
+        insertAt(update, top, std::move(searchKey), std::move(newValue), searchPrefix);
+    }
 
-        if (currNode->key == searchKey) {
+    //Predecessor search driven one hop at a time, so a caller can keep
+    //several searches in flight and switch between them (driver -W). Each
+    //step follows or descends from one node and prefetches the next node it
+    //will compare against. Finish with insert_at/erase_at/find_at.
+    struct Search {
+        const K* key;
+        PrefixType prefix;
+        NodeType* curr;
+        int level;
+        int top;                // max_curr_level when the search started
+        bool writer;            // insert/erase stop before nodes still being linked
+        NodeType* update[MAXLEVEL+1];
+    };
+
+    void search_begin(Search& s, const K& searchKey, bool writer)
+    {
+        s.key = &searchKey;
+        s.prefix = Traits::prefix(searchKey);
+        s.curr = m_pHeader;
+        s.top = s.level = max_curr_level;
+        s.writer = writer;
+        __builtin_prefetch(m_pHeader->forwards[s.level]);
+    }
+
+    //Returns true once update[1..top] hold the predecessors
+    bool search_step(Search& s)
+    {
+        NodeType* next = s.curr->forwards[s.level];
+        if (keyLess(next, *s.key, s.prefix) && (!s.writer || next->valid)) {
+            s.curr = next;
+        } else {
+            s.update[s.level] = s.curr;
+            if (--s.level < 1)
+                return true;
+        }
+        __builtin_prefetch(s.curr->forwards[s.level]);
+        return false;
+    }
+
+    //searchKey must be the key the (writer) search was begun with
+    void insert_at(Search& s, K searchKey, V newValue)
+    {
+        insertAt(s.update, s.top, std::move(searchKey), std::move(newValue), s.prefix);
+    }
+
+    void erase_at(Search& s)
+    {
+        eraseAt(s.update, s.top, *s.key, s.prefix);
+    }
+
+    bool find_at(Search& s, V& outValue)
+    {
+        NodeType* currNode = s.update[1]->forwards[1];
+        if (keyEqual(currNode, *s.key, s.prefix)) {
+            outValue = currNode->value;
+            return true;
+        }
+        return false;
+    }
+
+protected:
+    //Second half of insert, from the predecessors update[1..top] of a search
+    void insertAt(NodeType** update, int top, K searchKey, V newValue, PrefixType searchPrefix)
+    {
+        NodeType* currNode = update[1]->forwards[1];
+        beginWrite();
+
+        if (keyEqual(currNode, searchKey, searchPrefix)) {
 	    //pthread_mutex_lock(&currNode->lock);
 
-            currNode->value = newValue;
+            currNode->value = std::move(newValue);
 	    //pthread_mutex_unlock(&currNode->lock);
         } else {
             int newlevel = randomLevel();
-            if (newlevel > max_curr_level) {
-		pthread_mutex_lock(&lock);
-                for (int level = max_curr_level+1; level <= newlevel; level++) {
+            if (newlevel > top) {
+		//levels the search did not cover start from the header; the
+		//linking below walks forward from there if nodes exist
+                for (int level = top+1; level <= newlevel; level++) {
                     update[level] = m_pHeader;
                 }
-                max_curr_level = newlevel;
-		pthread_mutex_unlock(&lock);
+		int level = max_curr_level.load();
+		while (newlevel > level && !max_curr_level.compare_exchange_weak(level, newlevel))
+		    ;
             }
             
-	    currNode = new NodeType(searchKey,newValue);
+	    //the new node is not locked: nothing can reach it on a level before
+	    //it is linked there, and erase waits until it is valid. Locks are
+	    //only ever taken left to right (a node, then one with a larger key).
+	    currNode = allocNode(std::move(searchKey),std::move(newValue));
 	    currNode->toplevel = newlevel;
-	    pthread_mutex_lock(&currNode->lock);
 
             for (int lv = 1; lv <= newlevel; lv++) {
 		if(lv == 1) {
@@ -146,54 +472,65 @@ public:
 		    }
 		}
 
-		if( update[lv]->mark ){
-		    //update[lv] is deleted
+		while( update[lv]->mark ){
+		    //update[lv] is deleted, re-search from the header and
+		    //retry with the new predecessor (already holding its lock)
 		    pthread_mutex_unlock(&update[lv]->lock);
 		    NodeType* tempNode = m_pHeader;
-		    for (int level = max_curr_level; level >= lv; level--){
-			while (tempNode->forwards[level]->key < searchKey) {
-			    tempNode = tempNode->forwards[level];
+		    for (int level = std::max((int)max_curr_level, lv); level >= lv; level--){
+			NodeType* next;
+			while (keyLess(next = tempNode->forwards[level], currNode->key, searchPrefix)) {
+			    tempNode = next;
 			}
 			update[level] = tempNode;
 		    }
 		    pthread_mutex_lock(&update[lv]->lock);
-		    lv--;
-		    continue;
-		} else if( update[lv]->forwards[lv]->key > searchKey ){
-		    currNode->forwards[lv] = update[lv]->forwards[lv];
-		    update[lv]->forwards[lv] = currNode;
-		} else {
-		    //Newnode was inserted between update[lv] and currNode
+		}
+
+		//Nodes inserted after update[lv] since the search: move past them
+		while( keyLess(update[lv]->forwards[lv], currNode->key, searchPrefix) ){
 		    NodeType* nextNode = update[lv]->forwards[lv];
-			
+
 		    pthread_mutex_lock(&nextNode->lock);
 		    pthread_mutex_unlock(&update[lv]->lock);
-			
-		    update[lv] = nextNode;
-			
 
-		    while( nextNode->forwards[lv] != m_pTail && nextNode->forwards[lv]->key < searchKey ){
-			nextNode = update[lv]->forwards[lv];
-			    
-			pthread_mutex_lock(&nextNode->lock);
-			pthread_mutex_unlock(&update[lv]->lock);
-
-			update[lv] = nextNode;
-		    }
+		    update[lv] = nextNode;
+		}
 
-		    //Re-Searching is done
-		    currNode->forwards[lv] = update[lv]->forwards[lv];
-		    update[lv]->forwards[lv] = currNode;
-		
+		//A racing insert of the same key got there first: it wins, with
+		//this value, and the unlinked new node is dropped
+		if( lv == 1 && keyEqual(update[1]->forwards[1], currNode->key, searchPrefix) &&
+		    !update[1]->forwards[1]->mark ){
+		    update[1]->forwards[1]->value = std::move(currNode->value);
+		    pthread_mutex_unlock(&update[1]->lock);
+		    freeNode(currNode);
+		    endWrite();
+		    return;
 		}
+
+		link(currNode, lv, update[lv]->forwards[lv]);
+		link(update[lv], lv, currNode);
 	    }
-	    currNode->valid = true;
+	    //stamped after the level-1 link, so a walk that starts after
+	    //snapshot v either sees the node or the node is newer than v
+	    currNode->insert_version.store(m_version.load());
+	    currNode->valid.store(true, std::memory_order_release);
 
 	    pthread_mutex_unlock(&update[newlevel]->lock);
-	    pthread_mutex_unlock(&currNode->lock);
+	    if (m_hash) {
+		//an erase that marked the node before it was indexed found
+		//nothing to remove; take the entry back out for it
+		m_hash->insert(currNode);
+		if (currNode->mark)
+		    m_hash->erase(currNode);
+	    }
+	    m_slots[trash_slot].size.fetch_add(1, std::memory_order_relaxed);
+	    countWrite();
 	}
+	endWrite();
     }
 
+public:
     /*
     void erase(K searchKey)
     {
@@ -227,117 +564,348 @@ public:
 
 
     ///* 
-    void erase(K searchKey)
+    void erase(const K& searchKey)
     {
         skiplist_node<K,V,MAXLEVEL>* update[MAXLEVEL+1];
         NodeType* currNode = m_pHeader;
+        PrefixType searchPrefix = Traits::prefix(searchKey);
+        int top = max_curr_level;
 
         // find predecessor 
-        for (int level = max_curr_level; level >= 1; level--) {
-            while (currNode->forwards[level]->valid && currNode->forwards[level]->key < searchKey ) {
-                currNode = currNode->forwards[level];
+        for (int level = top; level >= 1; level--) {
+            NodeType* next;
+            while ((next = currNode->forwards[level])->valid && keyLess(next, searchKey, searchPrefix) ) {
+                currNode = next;
             }
             update[level] = currNode;
         }
+        eraseAt(update, top, searchKey, searchPrefix);
+    }
 
-        currNode = currNode->forwards[1];
-	int toplevel = currNode->toplevel;
+    //Applies n writes with strictly ascending keys: erase keys[i] where
+    //erased[i], else insert keys[i] -> values[i] (both moved from). Each
+    //search starts, level by level, from the predecessors of the previous
+    //key when they are further along than the node reached from above, so
+    //a sorted batch costs about one traversal plus the gaps between keys.
+    void apply_sorted(K* keys, V* values, const bool* erased, int n)
+    {
+        skiplist_node<K,V,MAXLEVEL>* update[MAXLEVEL+1];
+        NodeType* finger[MAXLEVEL+1];
+        for (int level = 1; level <= MAXLEVEL; level++)
+            finger[level] = m_pHeader;
 
-        if (currNode->key == searchKey) {
-	    currNode->mark = true;
+        for (int i = 0; i < n; i++) {
+            NodeType* currNode = m_pHeader;
+            PrefixType searchPrefix = Traits::prefix(keys[i]);
+            int top = max_curr_level;
 
-	    //pthread_mutex_lock(&currNode->lock);
-            for (int lv = 1; lv <= toplevel; lv++) {
-		if(lv == 1) {
-                    pthread_mutex_lock(&update[lv]->lock);
-                } else {
-                    if( update[lv] != update[lv-1] ){
-                        pthread_mutex_unlock(&update[lv-1]->lock);
-                        pthread_mutex_lock(&update[lv]->lock);
-                    }
+            for (int level = top; level >= 1; level--) {
+                NodeType* f = finger[level];
+                if (f != m_pHeader && !f->mark &&
+                    (currNode == m_pHeader || keyLess(currNode, f->key, f->prefix)))
+                    currNode = f;
+                NodeType* next;
+                while ((next = currNode->forwards[level])->valid && keyLess(next, keys[i], searchPrefix)) {
+                    currNode = next;
                 }
-		pthread_mutex_lock(&currNode->lock);
-		if( update[lv]->mark ){
-                    //update[lv] is deleted
-                    pthread_mutex_unlock(&update[lv]->lock);
-                    NodeType* tempNode = m_pHeader;
-                    for (int level = max_curr_level; level >= lv; level--){
-                        while (tempNode->forwards[level]->key < searchKey) {
-                            tempNode = tempNode->forwards[level];
-                        }
-                        update[level] = tempNode;
-                    }
-		    pthread_mutex_lock(&update[lv]->lock);
-                    lv--;
-		    pthread_mutex_unlock(&currNode->lock);
-                    continue;
-                } else if( update[lv]->forwards[lv] == currNode ){
-                    update[lv]->forwards[lv] = currNode->forwards[lv];
-                } else{
-                    //Newnode was inserted between update[lv] and currNode
-                    NodeType* nextNode = update[lv]->forwards[lv];
+                update[level] = currNode;
+                finger[level] = currNode;
+            }
+            if (erased[i])
+                eraseAt(update, top, keys[i], searchPrefix);
+            else
+                insertAt(update, top, std::move(keys[i]), std::move(values[i]), searchPrefix);
+        }
+    }
+
+protected:
+    //Second half of erase, from the predecessors update[1..top] of a search
+    void eraseAt(NodeType** update, int top, const K& searchKey, PrefixType searchPrefix)
+    {
+        NodeType* currNode = update[1]->forwards[1];
+
+        if (!keyEqual(currNode, searchKey, searchPrefix))
+            return;
+
+	//still being linked: let its insert finish, which needs no lock of ours
+	while (!currNode->valid.load(std::memory_order_acquire))
+	    sched_yield();
+
+	//of several erases of one key, the one that marks the node unlinks it
+	pthread_mutex_lock(&currNode->lock);
+	bool marked = currNode->mark;
+	if (!marked) {
+	    beginWrite();
+	    currNode->erase_version.store(m_version.load());
+	    currNode->mark = true;
+	    if (m_hash)
+		m_hash->erase(currNode);
+	    //Registered before the unlink, so a running snapshot either still
+	    //reaches the node in the list or finds it here. A snapshot that
+	    //starts after the m_snapshots check has a version the node's
+	    //erase_version does not exceed, so it does not need it.
+	    if (m_snapshots.load() > 0) {
+		Slot& slot = m_slots[trash_slot];
+		pthread_mutex_lock(&slot.retired_lock);
+		slot.retired.push_back(currNode);
+		pthread_mutex_unlock(&slot.retired_lock);
+	    }
+	}
+	pthread_mutex_unlock(&currNode->lock);
+	if (marked)
+	    return;
 
-                    pthread_mutex_lock(&nextNode->lock);
-                    pthread_mutex_unlock(&update[lv]->lock);
+	int toplevel = currNode->toplevel;
+	//the node may be taller than the list was when the search began;
+	//the unlinking below walks forward from the header on those levels
+	for (int level = top+1; level <= toplevel; level++)
+	    update[level] = m_pHeader;
 
-                    update[lv] = nextNode;
+	for (int lv = 1; lv <= toplevel; lv++) {
+	    if(lv == 1) {
+		pthread_mutex_lock(&update[lv]->lock);
+	    } else {
+		if( update[lv] != update[lv-1] ){
+		    pthread_mutex_unlock(&update[lv-1]->lock);
+		    pthread_mutex_lock(&update[lv]->lock);
+		}
+	    }
+	    while( update[lv]->mark ){
+		//update[lv] is deleted, re-search from the header and
+		//retry with the new predecessor (already holding its lock)
+		pthread_mutex_unlock(&update[lv]->lock);
+		NodeType* tempNode = m_pHeader;
+		for (int level = std::max((int)max_curr_level, lv); level >= lv; level--){
+		    NodeType* next;
+		    while (keyLess(next = tempNode->forwards[level], searchKey, searchPrefix)) {
+			tempNode = next;
+		    }
+		    update[level] = tempNode;
+		}
+		pthread_mutex_lock(&update[lv]->lock);
+	    }
 
+	    //Nodes inserted between update[lv] and currNode: move past them
+	    while( update[lv]->forwards[lv] != currNode ){
+		NodeType* nextNode = update[lv]->forwards[lv];
 
-                    while( nextNode->forwards[lv] != currNode ){
-                        nextNode = update[lv]->forwards[lv];
+		pthread_mutex_lock(&nextNode->lock);
+		pthread_mutex_unlock(&update[lv]->lock);
 
-                        pthread_mutex_lock(&nextNode->lock);
-                        pthread_mutex_unlock(&update[lv]->lock);
+		update[lv] = nextNode;
+	    }
 
-                        update[lv] = nextNode;
-                    }
+	    //currNode's lock keeps inserts from linking after it meanwhile
+	    pthread_mutex_lock(&currNode->lock);
+	    link(update[lv], lv, currNode->forwards[lv]);
+	    pthread_mutex_unlock(&currNode->lock);
+	}
+	pthread_mutex_unlock(&update[toplevel]->lock);
 
-                    //Re-Searching is done
-                    update[lv]->forwards[lv] = currNode->forwards[lv];
+	TrashQueue[trash_slot].push(currNode);
+	m_slots[trash_slot].size.fetch_add(-1, std::memory_order_relaxed);
+	countWrite();
 
-                }
-		pthread_mutex_unlock(&currNode->lock);
-                
-            }
-	    pthread_mutex_unlock(&update[toplevel]->lock);
-            //pthread_mutex_unlock(&currNode->lock);
-	    
-	    long h = currNode->key % thread_sz;
-	    if( h < 0 ) h += thread_sz;
-	    TrashQueue[h].push(currNode);
-	    
-	    pthread_mutex_lock(&lock);
-	    pthread_mutex_lock(&m_pHeader->lock);
-            while (max_curr_level > 1 && m_pHeader->forwards[max_curr_level] == m_pTail) {
-		max_curr_level--;
-            }
-	    pthread_mutex_unlock(&m_pHeader->lock);
-	    pthread_mutex_unlock(&lock);
-        }
+	//Only a node on the top level can leave that level empty. The shrink
+	//is a CAS per level, with no lock. An insert may still be linking its
+	//upper levels when they are checked, so the height can drop below the
+	//tallest live node, by several levels, until an insert raises it again.
+	//Searches stay correct meanwhile; they only start lower and walk more.
+	int level = max_curr_level.load();
+	if (toplevel >= level) {
+	    while (level > 1 && m_pHeader->forwards[level] == m_pTail) {
+		if (max_curr_level.compare_exchange_weak(level, level - 1))
+		    level--;
+	    }
+	}
+	endWrite();
     }
+
+public:
     //
 
-    bool find(K searchKey, V& outValue)
+    bool find(const K& searchKey, V& outValue)
     {
+        if (FrozenType* frozen = frozenForLookups(1))
+            return frozen->find(searchKey, outValue);
+        if (m_hash) {
+            if (NodeType* node = m_hash->find(searchKey)) {
+                outValue = node->value;
+                return true;
+            }
+            if (!m_hash->overflowed())
+                return false;
+        }
+
         NodeType* currNode = m_pHeader;
+        PrefixType searchPrefix = Traits::prefix(searchKey);
         for (int level = max_curr_level; level >= 1; level--) {
-            while (currNode->forwards[level]->key < searchKey) {
-                currNode = currNode->forwards[level];
+            if constexpr (Traits::inline_keys) {
+                if (level <= INLINE_LEVELS) {
+                    //The inline copy decides whether to step, so a successor
+                    //that is only compared against is never loaded. A writer
+                    //may be between the two stores of link(): a stale copy
+                    //that says "step" is caught by checking the node itself,
+                    //one that says "stop" only descends early, and level 1
+                    //catches up below.
+                    while (currNode->nextKey(level) < searchKey) {
+                        NodeType* next = currNode->forwards[level];
+                        if (!keyLess(next, searchKey, searchPrefix))
+                            break;
+                        currNode = next;
+                    }
+                    continue;
+                }
             }
+            NodeType* next;
+            while (keyLess(next = currNode->forwards[level], searchKey, searchPrefix)) {
+                currNode = next;
+            }
+        }
+        NodeType* next;
+        while (keyLess(next = currNode->forwards[1], searchKey, searchPrefix)) {
+            currNode = next;
         }
         currNode = currNode->forwards[1];
-        if (currNode->key == searchKey) {
+        if (keyEqual(currNode, searchKey, searchPrefix)) {
             outValue = currNode->value;
             return true;
         }
         return false;
     }
 
+    //Looks up n independent keys. Up to FIND_GROUP searches advance in
+    //lockstep, one node hop each per round, and each prefetches the node it
+    //will compare against next, so the cache misses of different keys
+    //overlap instead of queueing behind each other. found[i]/outValues[i]
+    //receive the result for keys[i]. Returns the number of hits.
+    int find_many(const K* keys, int n, V* outValues, bool* found)
+    {
+        NodeType* curr[FIND_GROUP];
+        PrefixType prefix[FIND_GROUP];
+        int level[FIND_GROUP];
+        int active[FIND_GROUP];
+        int hits = 0;
+
+        if (FrozenType* frozen = frozenForLookups(n)) {
+            for (int i = 0; i < n; i++) {
+                found[i] = frozen->find(keys[i], outValues[i]);
+                hits += found[i];
+            }
+            return hits;
+        }
+        if (m_hash && !m_hash->overflowed()) {
+            for (int i = 0; i < n; i++)
+                m_hash->prefetch(keys[i]);
+            for (int i = 0; i < n; i++) {
+                NodeType* node = m_hash->find(keys[i]);
+                found[i] = node != nullptr;
+                if (node) {
+                    outValues[i] = node->value;
+                    hits++;
+                }
+            }
+            return hits;
+        }
+
+        for (int base = 0; base < n; base += FIND_GROUP) {
+            int m = std::min(FIND_GROUP, n - base);
+            int top = max_curr_level;
+            for (int i = 0; i < m; i++) {
+                curr[i] = m_pHeader;
+                prefix[i] = Traits::prefix(keys[base + i]);
+                level[i] = top;
+                active[i] = i;
+                __builtin_prefetch(m_pHeader->forwards[top]);
+            }
+
+            //active[0..live) are the searches still descending
+            int live = m;
+            while (live > 0) {
+                for (int a = 0; a < live; ) {
+                    int i = active[a];
+                    NodeType* next = curr[i]->forwards[level[i]];
+                    if (keyLess(next, keys[base + i], prefix[i])) {
+                        curr[i] = next;
+                    } else if (level[i] > 1) {
+                        level[i]--;
+                    } else {
+                        found[base + i] = keyEqual(next, keys[base + i], prefix[i]);
+                        if (found[base + i]) {
+                            outValues[base + i] = next->value;
+                            hits++;
+                        }
+                        active[a] = active[--live];
+                        continue;
+                    }
+                    __builtin_prefetch(curr[i]->forwards[level[i]]);
+                    a++;
+                }
+            }
+        }
+        return hits;
+    }
+
     bool empty() const
     {
         return (m_pHeader->forwards[1] == m_pTail);
     }
 
+    //Approximate number of keys: the sum of per-thread insert/erase counters,
+    //exact once writers are quiescent.
+    long size() const
+    {
+	long n = 0;
+	for (int i = 0; i < m_numSlots; i++)
+	    n += m_slots[i].size.load(std::memory_order_relaxed);
+	return n > 0 ? n : 0;
+    }
+
+    //Calls emit(key, value) for every key present when the call starts, while
+    //writers keep running. Keys come in ascending order, followed (again in
+    //ascending order) by keys erased during the walk before it reached them.
+    //Values are read when visited, not versioned. Returns the number of keys.
+    template<class F>
+    long snapshot(F emit)
+    {
+	pthread_mutex_lock(&snapshot_lock);
+	m_snapshots.fetch_add(1);
+	uint64_t v = m_version.fetch_add(1);
+	long count = 0;
+
+	for (NodeType* currNode = m_pHeader->forwards[1]; currNode != m_pTail;
+	     currNode = currNode->forwards[1]) {
+	    if (visible(currNode, v)) {
+		currNode->seen_version.store(v);
+		emit(currNode->key, currNode->value);
+		count++;
+	    }
+	}
+
+	m_snapshots.fetch_sub(1);
+	std::vector<NodeType*> missed;
+	for (int i = 0; i < m_numSlots; i++) {
+	    Slot& slot = m_slots[i];
+	    pthread_mutex_lock(&slot.retired_lock);
+	    for (NodeType* node : slot.retired) {
+		if (visible(node, v) && node->seen_version.load() != v)
+		    missed.push_back(node);
+	    }
+	    slot.retired.clear();
+	    pthread_mutex_unlock(&slot.retired_lock);
+	}
+	std::sort(missed.begin(), missed.end(), [](const NodeType* a, const NodeType* b) {
+	    return Traits::less(a->key, a->prefix, b->key, b->prefix);
+	});
+	for (NodeType* node : missed) {
+	    emit(node->key, node->value);
+	    count++;
+	}
+
+	pthread_mutex_unlock(&snapshot_lock);
+	return count;
+    }
+
     std::string printList()
     {
         int i = 0;
@@ -355,45 +923,309 @@ public:
     void TrashSet()
     {
 	TrashQueue.resize(thread_sz);	
+	m_slots.reset(new Slot[thread_sz]);
+	m_numSlots = thread_sz;
+	for (int i = 0; i < m_numSlots; i++)
+	    m_slots[i].rng = 0x9E3779B97F4A7C15UL * (i + 1);
+    }
+
+    //Each worker thread owns one trash queue (erased nodes are freed after join)
+    void TrashBind(int slot)
+    {
+	trash_slot = slot;
+    }
+
+    //From now on every thread carves its nodes out of its own slot's chunks.
+    //A chunk is first touched by the thread that allocated it, so with the
+    //threads pinned its pages sit on that thread's NUMA node. Call before
+    //the workers start.
+    void PoolEnable()
+    {
+	m_pooled = true;
+    }
+
+    //Indexes every key in a skiplist_hash sized for about expected keys, so
+    //find/find_many are a probe or two; the list still orders the keys for
+    //everything else. Call before the workers start.
+    void HashEnable(size_t expected)
+    {
+	m_hash.reset(new HashType(expected));
+	for (NodeType* currNode = m_pHeader->forwards[1]; currNode != m_pTail;
+	     currNode = currNode->forwards[1])
+	    m_hash->insert(currNode);
+    }
+
+    //From now on a thread that has made FREEZE_MIN lookups (and at least as
+    //many as there are keys) since its last write calls freeze() itself.
+    void FreezeEnable()
+    {
+	m_freeze_auto = true;
+    }
+
+    //Copies the list into a skiplist_frozen that find/find_many use until
+    //the next insert or erase. Gives up, returning false, if a write is in
+    //progress or starts during the copy, or another freeze is running.
+    bool freeze()
+    {
+	if (m_frozen.load())
+	    return true;
+	if (pthread_mutex_trylock(&freeze_lock) != 0)
+	    return false;
+
+	long begun = writesBegun();
+	bool quiet = begun == writesDone();
+	if (quiet) {
+	    std::vector<std::pair<K,V>> sorted;
+	    sorted.reserve(size());
+	    for (NodeType* currNode = m_pHeader->forwards[1]; currNode != m_pTail;
+		 currNode = currNode->forwards[1]) {
+		if (currNode->valid && !currNode->mark)
+		    sorted.emplace_back(currNode->key, currNode->value);
+	    }
+	    FrozenType* frozen = new FrozenType(sorted);
+
+	    //a writer bumps its counter before checking m_frozen, so either
+	    //it sees (and drops) this image or the recount below sees it
+	    m_frozen.store(frozen);
+	    if (writesBegun() != begun) {
+		quiet = false;
+		FrozenType* expected = frozen;
+		if (m_frozen.compare_exchange_strong(expected, nullptr))
+		    retireFrozen(frozen);
+	    }
+	}
+	pthread_mutex_unlock(&freeze_lock);
+	return quiet;
     }
 
     void TrashEmpty()
     {
+	for (FrozenType* frozen : m_frozen_retired)
+	    delete frozen;
+	m_frozen_retired.clear();
+	//registered after the last snapshot drained them; about to be freed
+	for (int i = 0; i < m_numSlots; i++)
+	    m_slots[i].retired.clear();
 	int sz = TrashQueue.size();
 	for(int i = 0; i < sz; i++)
 	{
 	    while(!TrashQueue[i].empty())
 	    {
-		delete TrashQueue[i].front();
+		freeNode(TrashQueue[i].front());
 		TrashQueue[i].pop();
 	    }
 	}
     }
 
-    const int max_level;
+    static const int max_level = MAXLEVEL;
 
 protected:
-    double uniformRandom()
+    //Per-thread counters, retired-node lists and node pools, one cache line each
+    struct alignas(64) Slot {
+	std::atomic<long> size{0};
+	pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+	std::vector<NodeType*> retired;
+	char* pool_next = nullptr;
+	size_t pool_left = 0;
+	std::vector<void*> pool_chunks;
+	std::atomic<long> writes_begun{0};
+	std::atomic<long> writes_done{0};
+	long lookups = 0;           // since this thread's last write
+	unsigned long rng = 1;      // xorshift64* state for randomLevel
+	int writes_untuned = 0;     // since this thread last called retune
+    };
+
+    //Every insert/erase that changes the list is bracketed by these, and
+    //drops the frozen image before touching a node
+    void beginWrite()
+    {
+	Slot& slot = m_slots[trash_slot];
+	slot.writes_begun.fetch_add(1);
+	slot.lookups = 0;
+	if (m_frozen.load() != nullptr) {
+	    FrozenType* frozen = m_frozen.exchange(nullptr);
+	    if (frozen)
+		retireFrozen(frozen);
+	}
+    }
+
+    void endWrite()
+    {
+	m_slots[trash_slot].writes_done.fetch_add(1, std::memory_order_release);
+    }
+
+    long writesBegun() const
+    {
+	long n = 0;
+	for (int i = 0; i < m_numSlots; i++)
+	    n += m_slots[i].writes_begun.load();
+	return n;
+    }
+
+    long writesDone() const
+    {
+	long n = 0;
+	for (int i = 0; i < m_numSlots; i++)
+	    n += m_slots[i].writes_done.load();
+	return n;
+    }
+
+    //The image to answer n lookups from, if any; counts them towards an
+    //automatic freeze
+    FrozenType* frozenForLookups(int n)
+    {
+	FrozenType* frozen = m_frozen.load(std::memory_order_acquire);
+	if (frozen || !m_freeze_auto)
+	    return frozen;
+	Slot& slot = m_slots[trash_slot];
+	slot.lookups += n;
+	if (slot.lookups >= FREEZE_MIN && slot.lookups >= size()) {
+	    slot.lookups = 0;
+	    if (freeze())
+		return m_frozen.load(std::memory_order_acquire);
+	}
+	return nullptr;
+    }
+
+    //Lookups may still be reading a dropped image; it is freed by TrashEmpty
+    //(after the workers are joined) or with the list
+    void retireFrozen(FrozenType* frozen)
     {
-        return rand() / double(RAND_MAX);
+	pthread_mutex_lock(&freeze_lock_retired);
+	m_frozen_retired.push_back(frozen);
+	pthread_mutex_unlock(&freeze_lock_retired);
     }
 
+    NodeType* allocNode(K key, V value)
+    {
+	if (!m_pooled)
+	    return new NodeType(std::move(key), std::move(value));
+
+	const size_t sz = (sizeof(NodeType) + 63) & ~(size_t)63;
+	Slot& slot = m_slots[trash_slot];
+	if (slot.pool_left < sz) {
+	    void* chunk = aligned_alloc(64, POOL_CHUNK);
+	    if (!chunk)
+		throw std::bad_alloc();
+	    slot.pool_chunks.push_back(chunk);
+	    slot.pool_next = static_cast<char*>(chunk);
+	    slot.pool_left = POOL_CHUNK;
+	}
+	NodeType* node = new (slot.pool_next) NodeType(std::move(key), std::move(value));
+	node->pooled = true;
+	slot.pool_next += sz;
+	slot.pool_left -= sz;
+	return node;
+    }
+
+    //Pooled memory goes back with its chunk when the list is destroyed
+    static void freeNode(NodeType* node)
+    {
+	if (node->pooled)
+	    node->~NodeType();
+	else
+	    delete node;
+    }
+
+    //Points node's level lv at next. Callers hold node->lock.
+    static void link(NodeType* node, int lv, NodeType* next)
+    {
+        if constexpr (Traits::inline_keys)
+            if (lv <= INLINE_LEVELS)
+                node->nextKey(lv) = next->key;
+        node->forwards[lv] = next;
+    }
+
+    static bool visible(const NodeType* node, uint64_t v)
+    {
+	return node->insert_version.load() <= v && node->erase_version.load() > v;
+    }
+
+    static bool keyLess(const NodeType* node, const K& key, PrefixType prefix)
+    {
+        return Traits::less(node->key, node->prefix, key, prefix);
+    }
+
+    static bool keyGreater(const NodeType* node, const K& key, PrefixType prefix)
+    {
+        return Traits::less(key, prefix, node->key, node->prefix);
+    }
+
+    static bool keyEqual(const NodeType* node, const K& key, PrefixType prefix)
+    {
+        return Traits::equal(node->key, node->prefix, key, prefix);
+    }
+
+    //Levels are geometric with p = 2^-m_level_shift, capped at m_level_cap.
+    //Each trailing zero bit of a random word is one coin flip at p = 1/2.
     int randomLevel() {
-        int level = 1;
-        double p = 0.5;
-        while (uniformRandom() < p && level < MAXLEVEL) {
-            level++;
-        }
-        return level;
+        unsigned long& x = m_slots[trash_slot].rng;
+        x ^= x >> 12; x ^= x << 25; x ^= x >> 27;
+        unsigned long r = x * 2685821657736338717UL;
+        int level = 1 + __builtin_ctzl(r | (1UL << 63)) / m_level_shift.load(std::memory_order_relaxed);
+        return std::min(level, m_level_cap.load(std::memory_order_relaxed));
+    }
+
+    void countWrite()
+    {
+	Slot& slot = m_slots[trash_slot];
+	if (++slot.writes_untuned >= TUNE_INTERVAL) {
+	    slot.writes_untuned = 0;
+	    retune();
+	}
+    }
+
+    //Sizes the levels for the current key count n: with p = 1/2 a list
+    //wants about log2(n) + 1 levels, so small lists get a lower cap. Past
+    //MAXLEVEL the surplus piles onto the top level, which is cheap while it
+    //stays short and cached; once it would hold more than 2^TOP_RUN_BITS
+    //nodes p drops to 1/4, 1/8, ... instead (a lower p lengthens the runs
+    //on every level, so it is not worth it earlier).
+    void retune()
+    {
+	const int TOP_RUN_BITS = 8;
+	long n = size();
+	int bits = 1;
+	while (bits < 62 && (1L << bits) < n)
+	    bits++;
+	int shift = 1;
+	while (bits - shift * (MAXLEVEL - 1) > TOP_RUN_BITS)
+	    shift++;
+	m_level_shift.store(shift, std::memory_order_relaxed);
+	m_level_cap.store(std::min(MAXLEVEL, (bits + shift - 1) / shift + 1), std::memory_order_relaxed);
     }
 
     K m_minKey;
     K m_maxKey;
-    int max_curr_level;
-    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    std::atomic<int> max_curr_level;
+    std::atomic<int> m_level_cap{MAXLEVEL};    // tallest level randomLevel returns
+    std::atomic<int> m_level_shift{1};         // -log2 of the level probability
     skiplist_node<K,V,MAXLEVEL>* m_pHeader;
     skiplist_node<K,V,MAXLEVEL>* m_pTail;
     vector<queue<skiplist_node<K,V,MAXLEVEL>*>> TrashQueue;
+    static thread_local int trash_slot;
+
+    std::atomic<uint64_t> m_version;        // bumped by every snapshot
+    std::atomic<int> m_snapshots;           // snapshots currently walking
+    pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+    std::unique_ptr<Slot[]> m_slots;
+    int m_numSlots;
+    bool m_pooled = false;
+
+    std::atomic<FrozenType*> m_frozen;      // read-only image, until the next write
+    bool m_freeze_auto = false;
+    pthread_mutex_t freeze_lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_t freeze_lock_retired = PTHREAD_MUTEX_INITIALIZER;
+    std::vector<FrozenType*> m_frozen_retired;
+    std::unique_ptr<HashType> m_hash;       // point-lookup index, if enabled
 };
 
+template<class K, class V, int MAXLEVEL>
+thread_local int skiplist<K,V,MAXLEVEL>::trash_slot = 0;
+
+//A skiplist whose MAXLEVEL is fixed at compile time from the number of keys
+//it is expected to hold
+template<class K, class V, unsigned long EXPECTED>
+using sized_skiplist = skiplist<K, V, skiplist_levels(EXPECTED)>;
 
+#endif
@@ -0,0 +1,30 @@
+/*
+ * trace.h
+ *
+ * Binary workload trace format shared by inputgen (-b) and the driver.
+ *
+ * A trace starts with an 8-byte magic and a little-endian record count,
+ * followed by fixed-size records. Text traces ("i 42\n") are still the
+ * default; the driver tells them apart by the magic.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC     "SLTRACE1"
+#define TRACE_MAGIC_LEN 8
+
+typedef struct {
+    char magic[TRACE_MAGIC_LEN];
+    uint64_t count;
+} trace_header;
+
+typedef struct {
+    int64_t key;
+    char type;      // 'i', 'q' or 'd'
+    char pad[7];
+} trace_record;
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * bench.h
+ *
+ * Small timing/scaling harness shared by problem1 and problem2 (-b mode):
+ * each kernel runs `reps` times per (N, threads) point, the median wall time
+ * is reported together with GFLOP/s and the speedup over the serial
+ * reference at the same N, and every point is appended to a CSV file.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+struct BenchOptions {
+    std::vector<long> sizes;        // -N 1024,4096,...
+    std::vector<int> threads;       // -T 1,2,4,...
+    int reps = 5;                   // -r
+    const char* csv = nullptr;      // -o
+};
+
+/* Parse a comma-separated list of positive integers ("1024,4096"). */
+template<class T>
+std::vector<T> parseList(const char* arg) {
+    std::vector<T> out;
+    std::string s(arg);
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t comma = s.find(',', pos);
+        if (comma == std::string::npos) comma = s.size();
+        long v = atol(s.substr(pos, comma - pos).c_str());
+        if (v <= 0) {
+            fprintf(stderr, "invalid list element in '%s'\n", arg);
+            exit(EXIT_FAILURE);
+        }
+        out.push_back((T)v);
+        pos = comma + 1;
+    }
+    return out;
+}
+
+/* Median wall time of reps calls of run(), after one untimed warm-up call. */
+template<class Run>
+double benchTime(Run run, int reps) {
+    std::vector<double> times(reps);
+    run();
+    for (int r = 0; r < reps; r++) {
+        double start = omp_get_wtime();
+        run();
+        times[r] = omp_get_wtime() - start;
+    }
+    std::sort(times.begin(), times.end());
+    return times[reps / 2];
+}
+
+class BenchReport {
+public:
+    explicit BenchReport(const char* csvPath) : csv(nullptr) {
+        if (csvPath) {
+            csv = fopen(csvPath, "w");
+            if (!csv) {
+                perror("fopen");
+                exit(EXIT_FAILURE);
+            }
+            fprintf(csv, "kernel,n,threads,reps,seconds,gflops,speedup\n");
+        }
+        printf("%-12s %10s %8s %12s %10s %9s\n", "kernel", "N", "threads", "seconds", "GFLOP/s", "speedup");
+    }
+
+    ~BenchReport() {
+        if (csv) fclose(csv);
+    }
+
+    /* flops is the work of one call; refSeconds the serial reference at this N. */
+    void add(const char* kernel, long n, int threads, int reps,
+             double seconds, double flops, double refSeconds) {
+        double gflops = flops / seconds * 1e-9;
+        double speedup = refSeconds / seconds;
+        printf("%-12s %10ld %8d %12.6f %10.3f %9.2f\n", kernel, n, threads, seconds, gflops, speedup);
+        fflush(stdout);
+        if (csv) {
+            fprintf(csv, "%s,%ld,%d,%d,%.9f,%.6f,%.4f\n", kernel, n, threads, reps, seconds, gflops, speedup);
+        }
+    }
+
+private:
+    FILE* csv;
+};
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * input.h
+ *
+ * Memory-mapped input files for problem1 and problem2 (-f). A file is a raw
+ * native-endian array of doubles (points are x,y pairs), as written by -w.
+ * Pages are only read when touched, and the streaming modes hand back the
+ * ranges they have finished with, so inputs larger than RAM can be processed
+ * chunk by chunk.
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+class MappedFile {
+public:
+    explicit MappedFile(const char* path) : data(nullptr), bytes(0) {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+        bytes = st.st_size;
+        if (bytes > 0) {
+            data = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                perror("mmap");
+                exit(EXIT_FAILURE);
+            }
+            madvise(data, bytes, MADV_SEQUENTIAL);
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (data) munmap(data, bytes);
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    template<class T>
+    const T* as() const { return static_cast<const T*>(data); }
+
+    template<class T>
+    size_t count() const { return bytes / sizeof(T); }
+
+    /* Drop the pages wholly inside [from, to) bytes; they are read back
+       from the file if touched again.
+    */
+    void release(size_t from, size_t to) const {
+        size_t page = sysconf(_SC_PAGESIZE);
+        from = (from + page - 1) / page * page;
+        to = to / page * page;
+        if (data && from < to) {
+            madvise(static_cast<char*>(data) + from, to - from, MADV_DONTNEED);
+        }
+    }
+
+private:
+    void* data;
+    size_t bytes;
+};
+
+/* Write bytes of data to path, replacing it. */
+inline void writeFile(const char* path, const void* data, size_t bytes) {
+    FILE* f = fopen(path, "wb");
+    if (!f || fwrite(data, 1, bytes, f) != bytes || fclose(f) != 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+#endif
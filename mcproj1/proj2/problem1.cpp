@@ -1,12 +1,26 @@
 #include <stdlib.h>
+#include <unistd.h>
 #include <cmath>
 #include <vector>
 #include <limits>
+#include <algorithm>
+#include <queue>
+#include <utility>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <omp.h>
+#include "bench.h"
+#include "input.h"
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 #define POINTS_MIN  1.0
 #define POINTS_MAX  1000.0
+#define PAIR_TILE   1024    // points per tile in the parallel brute force (2 x 8KB of SoA)
+#define KD_LEAF     8       // k-d tree ranges this small are scanned, not split
+#define KD_TASK_MIN 16384   // smallest subtree built as its own OpenMP task
 
 struct Point {
     double x, y;
@@ -16,6 +30,11 @@ double getDistance(Point const& p1, Point const& p2) {
     return std::sqrt(std::pow(p2.x-p1.x, 2) + std::pow(p2.y-p1.y, 2));
 }
 
+static inline double getSquaredDistance(Point const& p1, Point const& p2) {
+    double dx = p2.x - p1.x, dy = p2.y - p1.y;
+    return dx*dx + dy*dy;
+}
+
 /* Return the distance between the closest two points in the vector points.
 
    Example:
@@ -42,32 +61,823 @@ double closestPair(std::vector<Point> const& points) {
     return min_dist;
 }
 
-int main(int argc, char **argv) {
-    int N = 1024;
-    int seed = 17;
+/* Smallest squared distance from (xi, yi) to the points j0 <= j < j1 of the
+   structure-of-arrays xs/ys, never larger than best.
+*/
+static inline double minSquaredDistance(double xi, double yi, const double* xs, const double* ys,
+                                        size_t j0, size_t j1, double best) {
+    size_t j = j0;
+#if defined(__AVX512F__)
+    __m512d vxi = _mm512_set1_pd(xi), vyi = _mm512_set1_pd(yi);
+    __m512d vbest = _mm512_set1_pd(best);
+    for (; j + 8 <= j1; j += 8) {
+        __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(xs + j), vxi);
+        __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(ys + j), vyi);
+        vbest = _mm512_min_pd(vbest, _mm512_fmadd_pd(dx, dx, _mm512_mul_pd(dy, dy)));
+    }
+    best = _mm512_reduce_min_pd(vbest);
+#elif defined(__AVX2__)
+    __m256d vxi = _mm256_set1_pd(xi), vyi = _mm256_set1_pd(yi);
+    __m256d vbest = _mm256_set1_pd(best);
+    for (; j + 4 <= j1; j += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(xs + j), vxi);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(ys + j), vyi);
+        vbest = _mm256_min_pd(vbest, _mm256_fmadd_pd(dx, dx, _mm256_mul_pd(dy, dy)));
+    }
+    __m128d m = _mm_min_pd(_mm256_castpd256_pd128(vbest), _mm256_extractf128_pd(vbest, 1));
+    best = std::min(_mm_cvtsd_f64(m), _mm_cvtsd_f64(_mm_unpackhi_pd(m, m)));
+#else
+    #pragma omp simd reduction(min:best)
+    for (size_t k = j0; k < j1; k++) {
+        double dx = xs[k] - xi, dy = ys[k] - yi;
+        best = std::min(best, dx*dx + dy*dy);
+    }
+    j = j1;
+#endif
+    for (; j < j1; j++) {
+        double dx = xs[j] - xi, dy = ys[j] - yi;
+        best = std::min(best, dx*dx + dy*dy);
+    }
+    return best;
+}
+
+/* Single-precision version of the above: twice the lanes per vector. */
+static inline float minSquaredDistance(float xi, float yi, const float* xs, const float* ys,
+                                       size_t j0, size_t j1, float best) {
+    size_t j = j0;
+#if defined(__AVX512F__)
+    __m512 vxi = _mm512_set1_ps(xi), vyi = _mm512_set1_ps(yi);
+    __m512 vbest = _mm512_set1_ps(best);
+    for (; j + 16 <= j1; j += 16) {
+        __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(xs + j), vxi);
+        __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(ys + j), vyi);
+        vbest = _mm512_min_ps(vbest, _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy)));
+    }
+    best = _mm512_reduce_min_ps(vbest);
+#elif defined(__AVX2__)
+    __m256 vxi = _mm256_set1_ps(xi), vyi = _mm256_set1_ps(yi);
+    __m256 vbest = _mm256_set1_ps(best);
+    for (; j + 8 <= j1; j += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs + j), vxi);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys + j), vyi);
+        vbest = _mm256_min_ps(vbest, _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy)));
+    }
+    __m128 m = _mm_min_ps(_mm256_castps256_ps128(vbest), _mm256_extractf128_ps(vbest, 1));
+    m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+    best = _mm_cvtss_f32(m);
+#else
+    #pragma omp simd reduction(min:best)
+    for (size_t k = j0; k < j1; k++) {
+        float dx = xs[k] - xi, dy = ys[k] - yi;
+        best = std::min(best, dx*dx + dy*dy);
+    }
+    j = j1;
+#endif
+    for (; j < j1; j++) {
+        float dx = xs[j] - xi, dy = ys[j] - yi;
+        best = std::min(best, dx*dx + dy*dy);
+    }
+    return best;
+}
 
-    if (argc == 2) {
-        N = std::stoi(argv[1]);
+/* Parallel brute force: same O(n^2) pair scan as closestPair, over a
+   structure-of-arrays copy in PAIR_TILE x PAIR_TILE blocks so the inner
+   tile stays in L1. Each thread keeps its own minimum of squared
+   distances (OpenMP min reduction) and the root is taken once at the end.
+
+   T is the precision of the scan. The copy is centred on the bounding box
+   so float keeps as many bits of the differences as it can. With Refine the
+   scan also remembers which row i produced the minimum; that row is then
+   rescanned in double, so the result is the exact distance of a real pair
+   and is only off when float rounding ranks a different pair first.
+*/
+template<class T, bool Refine>
+double closestPairOmpT(std::vector<Point> const& points) {
+    size_t n = points.size();
+    if (n < 2) {
+        return 0;
     }
-    if (argc == 3) {
-	    N = std::stoi(argv[1]);
-	    seed = std::stoi(argv[2]);
+
+    double minX = points[0].x, maxX = minX, minY = points[0].y, maxY = minY;
+    for (Point const& p : points) {
+        minX = std::min(minX, p.x); maxX = std::max(maxX, p.x);
+        minY = std::min(minY, p.y); maxY = std::max(maxY, p.y);
     }
+    double cx = (minX + maxX) / 2, cy = (minY + maxY) / 2;
 
-    std::vector<Point> points(N);
+    std::vector<T> xs(n), ys(n);
+    for (size_t i = 0; i < n; i++) {
+        xs[i] = (T)(points[i].x - cx);
+        ys[i] = (T)(points[i].y - cy);
+    }
+
+    size_t tiles = (n + PAIR_TILE - 1) / PAIR_TILE;
+    T best = std::numeric_limits<T>::max();
+    size_t bestRow = 0;
+
+    // Row a of the tile triangle gets shorter as a grows, hence dynamic
+    #pragma omp parallel
+    {
+        T mine = std::numeric_limits<T>::max();
+        size_t mineRow = 0;
+
+        #pragma omp for schedule(dynamic, 1) nowait
+        for (size_t a = 0; a < tiles; a++) {
+            size_t i0 = a * PAIR_TILE, i1 = std::min(n, i0 + PAIR_TILE);
+            for (size_t b = a; b < tiles; b++) {
+                size_t j0 = b * PAIR_TILE, j1 = std::min(n, j0 + PAIR_TILE);
+                for (size_t i = i0; i < i1; i++) {
+                    T d = minSquaredDistance(xs[i], ys[i], xs.data(), ys.data(),
+                                             a == b ? i + 1 : j0, j1, mine);
+                    if (Refine && d < mine) mineRow = i;
+                    mine = d;
+                }
+            }
+        }
+
+        #pragma omp critical
+        if (mine < best) {
+            best = mine;
+            bestRow = mineRow;
+        }
+    }
+
+    if (!Refine) {
+        return std::sqrt((double)best);
+    }
+
+    double exact = std::numeric_limits<double>::max();
+    for (size_t j = 0; j < n; j++) {
+        if (j != bestRow) exact = std::min(exact, getSquaredDistance(points[bestRow], points[j]));
+    }
+    return std::sqrt(exact);
+}
+
+double closestPairOmp(std::vector<Point> const& points) {
+    return closestPairOmpT<double, false>(points);
+}
+
+/* Squared closest-pair distance of px[0..n), which must be sorted by x.
+   On return px is sorted by y; buf is scratch space of at least n points.
+*/
+static double closestPairRec(Point* px, Point* buf, size_t n) {
+    auto byY = [](Point const& a, Point const& b) { return a.y < b.y; };
+
+    if (n <= 3) {
+        double best = std::numeric_limits<double>::max();
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = i+1; j < n; j++)
+                best = std::min(best, getSquaredDistance(px[i], px[j]));
+        std::sort(px, px + n, byY);
+        return best;
+    }
+
+    size_t mid = n / 2;
+    double midX = px[mid].x;
+    double best = std::min(closestPairRec(px, buf, mid),
+                           closestPairRec(px + mid, buf, n - mid));
+
+    // Both halves come back sorted by y: merge them
+    std::merge(px, px + mid, px + mid, px + n, buf, byY);
+    std::copy(buf, buf + n, px);
+
+    // Only points within sqrt(best) of the dividing line can do better
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        double dx = px[i].x - midX;
+        if (dx*dx < best) buf[m++] = px[i];
+    }
+    for (size_t i = 0; i < m; i++) {
+        for (size_t j = i+1; j < m; j++) {
+            double dy = buf[j].y - buf[i].y;
+            if (dy*dy >= best) break;
+            best = std::min(best, getSquaredDistance(buf[i], buf[j]));
+        }
+    }
+    return best;
+}
+
+/* Divide-and-conquer closest pair: sort by x, recurse on halves, merge by y
+   and check the strip around the dividing line. O(n log n).
+*/
+double closestPairDC(std::vector<Point> const& points) {
+    if (points.size() < 2) {
+        return 0;
+    }
+
+    std::vector<Point> px(points), buf(points.size());
+    std::sort(px.begin(), px.end(), [](Point const& a, Point const& b) { return a.x < b.x; });
+    return std::sqrt(closestPairRec(px.data(), buf.data(), px.size()));
+}
+
+/* Uniform-grid closest pair: bucket the points into ~n cells over their
+   bounding box and compare each point with its own and neighbouring cells.
+   Expected O(n) for evenly spread points. If the best pair found is wider
+   than a cell a closer pair could hide further away, so fall back to the
+   divide-and-conquer engine.
+*/
+double closestPairGrid(std::vector<Point> const& points) {
+    size_t n = points.size();
+    if (n < 2) {
+        return 0;
+    }
+
+    double minX = points[0].x, maxX = minX, minY = points[0].y, maxY = minY;
+    for (Point const& p : points) {
+        minX = std::min(minX, p.x); maxX = std::max(maxX, p.x);
+        minY = std::min(minY, p.y); maxY = std::max(maxY, p.y);
+    }
+    double extent = std::max(maxX - minX, maxY - minY);
+    if (extent == 0) {
+        return 0;
+    }
+
+    long g = std::max(1L, (long)std::sqrt((double)n));
+    double cell = extent / g;
+    long gx = std::min(g, (long)((maxX - minX) / cell) + 1);
+    long gy = std::min(g, (long)((maxY - minY) / cell) + 1);
+
+    // Counting sort of the points by cell (row-major)
+    std::vector<long> cellOf(n), start(gx * gy + 1, 0);
+    for (size_t i = 0; i < n; i++) {
+        long cx = std::min(gx - 1, (long)((points[i].x - minX) / cell));
+        long cy = std::min(gy - 1, (long)((points[i].y - minY) / cell));
+        cellOf[i] = cy * gx + cx;
+        start[cellOf[i] + 1]++;
+    }
+    for (long c = 0; c < gx * gy; c++) start[c + 1] += start[c];
+    std::vector<Point> sorted(n);
+    std::vector<long> fill(start.begin(), start.end() - 1);
+    for (size_t i = 0; i < n; i++) sorted[fill[cellOf[i]]++] = points[i];
+
+    // Each unordered cell pair once: the cell itself, then E, NW, N, NE
+    static const int nbr[4][2] = { {1, 0}, {-1, 1}, {0, 1}, {1, 1} };
+    double best = std::numeric_limits<double>::max();
+    for (long cy = 0; cy < gy; cy++) {
+        for (long cx = 0; cx < gx; cx++) {
+            long c = cy * gx + cx;
+            for (long i = start[c]; i < start[c + 1]; i++) {
+                for (long j = i + 1; j < start[c + 1]; j++)
+                    best = std::min(best, getSquaredDistance(sorted[i], sorted[j]));
+                for (int k = 0; k < 4; k++) {
+                    long nx = cx + nbr[k][0], ny = cy + nbr[k][1];
+                    if (nx < 0 || nx >= gx || ny >= gy) continue;
+                    long d = ny * gx + nx;
+                    for (long j = start[d]; j < start[d + 1]; j++)
+                        best = std::min(best, getSquaredDistance(sorted[i], sorted[j]));
+                }
+            }
+        }
+    }
+
+    if (best > cell * cell) {
+        return closestPairDC(points);
+    }
+    return std::sqrt(best);
+}
+
+/* Static 2-d tree over a point set, for serving many proximity queries
+   against one dataset. The tree is implicit: entries are reordered so that
+   the median of every range [lo, hi) on its axis (x at even depths, y at odd)
+   sits at the middle, with the smaller half to its left. Ranges of at most
+   KD_LEAF entries are left unsorted and scanned. Subtrees are built as
+   OpenMP tasks. Queries are const and can run concurrently. They return the
+   indices of the points in the vector the tree was built from.
+*/
+class KdTree {
+public:
+    explicit KdTree(std::vector<Point> const& points) : nodes(points.size()) {
+        for (size_t i = 0; i < points.size(); i++) {
+            nodes[i].p = points[i];
+            nodes[i].id = i;
+        }
+        #pragma omp parallel
+        #pragma omp single
+        build(0, nodes.size(), 0);
+    }
+
+    size_t size() const { return nodes.size(); }
+
+    /* Index of the point nearest to q, ignoring index skip (-1 for none), or
+       -1 if there is none. Its squared distance goes to *dist2.
+    */
+    long nearest(Point const& q, double* dist2 = nullptr, long skip = -1) const {
+        double best = std::numeric_limits<double>::max();
+        long bestId = -1;
+        nearestRec(0, nodes.size(), 0, q, skip, best, bestId);
+        if (dist2) *dist2 = best;
+        return bestId;
+    }
+
+    /* The k points nearest to q, closest first. */
+    void knn(Point const& q, size_t k, std::vector<long>& out) const {
+        Heap heap;
+        if (k > 0) knnRec(0, nodes.size(), 0, q, k, heap);
+        out.resize(heap.size());
+        for (size_t i = heap.size(); i-- > 0; heap.pop()) {
+            out[i] = heap.top().second;
+        }
+    }
+
+    /* Every point within distance r of q (inclusive), in no particular order. */
+    void radius(Point const& q, double r, std::vector<long>& out) const {
+        out.clear();
+        radiusRec(0, nodes.size(), 0, q, r * r, out);
+    }
+
+    /* All unordered pairs (i < j) within distance r of each other, sorted.
+       One radius query per point, split across threads.
+    */
+    void pairsWithin(double r, std::vector< std::pair<long, long> >& out) const {
+        out.clear();
+        #pragma omp parallel
+        {
+            std::vector< std::pair<long, long> > mine;
+            std::vector<long> hits;
+            #pragma omp for schedule(dynamic, 256)
+            for (size_t i = 0; i < nodes.size(); i++) {
+                radiusRec(0, nodes.size(), 0, nodes[i].p, r * r, hits);
+                for (long j : hits) {
+                    if (j > nodes[i].id) mine.push_back(std::make_pair(nodes[i].id, j));
+                }
+                hits.clear();
+            }
+            #pragma omp critical
+            out.insert(out.end(), mine.begin(), mine.end());
+        }
+        std::sort(out.begin(), out.end());
+    }
+
+    /* Answer nearest() for every query, in parallel. */
+    void nearestBatch(std::vector<Point> const& queries, std::vector<long>& out) const {
+        out.resize(queries.size());
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (size_t i = 0; i < queries.size(); i++) {
+            out[i] = nearest(queries[i]);
+        }
+    }
+
+    /* Closest-pair distance of the indexed points: each point's nearest
+       other point, minimised over all points in parallel.
+    */
+    double closestPair() const {
+        if (nodes.size() < 2) {
+            return 0;
+        }
+        double best = std::numeric_limits<double>::max();
+        #pragma omp parallel for schedule(dynamic, 256) reduction(min:best)
+        for (size_t i = 0; i < nodes.size(); i++) {
+            double d;
+            nearest(nodes[i].p, &d, nodes[i].id);
+            best = std::min(best, d);
+        }
+        return std::sqrt(best);
+    }
+
+private:
+    struct Entry {
+        Point p;
+        long id;
+    };
+    typedef std::priority_queue< std::pair<double, long> > Heap;   // farthest on top
+
+    std::vector<Entry> nodes;
+
+    static double axisOffset(Point const& q, Point const& p, int axis) {
+        return axis == 0 ? q.x - p.x : q.y - p.y;
+    }
+
+    void build(size_t lo, size_t hi, int axis) {
+        if (hi - lo <= KD_LEAF) return;
+        size_t mid = lo + (hi - lo) / 2;
+        std::nth_element(nodes.begin() + lo, nodes.begin() + mid, nodes.begin() + hi,
+                         [axis](Entry const& a, Entry const& b) {
+                             return axis == 0 ? a.p.x < b.p.x : a.p.y < b.p.y;
+                         });
+        #pragma omp task if (mid - lo > KD_TASK_MIN)
+        build(lo, mid, axis ^ 1);
+        build(mid + 1, hi, axis ^ 1);
+    }
+
+    void nearestRec(size_t lo, size_t hi, int axis, Point const& q, long skip,
+                    double& best, long& bestId) const {
+        if (hi - lo <= KD_LEAF) {
+            for (size_t i = lo; i < hi; i++) {
+                double d = getSquaredDistance(q, nodes[i].p);
+                if (d < best && nodes[i].id != skip) { best = d; bestId = nodes[i].id; }
+            }
+            return;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        double d = getSquaredDistance(q, nodes[mid].p);
+        if (d < best && nodes[mid].id != skip) { best = d; bestId = nodes[mid].id; }
+
+        double off = axisOffset(q, nodes[mid].p, axis);
+        if (off < 0) {
+            nearestRec(lo, mid, axis ^ 1, q, skip, best, bestId);
+            if (off * off < best) nearestRec(mid + 1, hi, axis ^ 1, q, skip, best, bestId);
+        } else {
+            nearestRec(mid + 1, hi, axis ^ 1, q, skip, best, bestId);
+            if (off * off < best) nearestRec(lo, mid, axis ^ 1, q, skip, best, bestId);
+        }
+    }
+
+    static void offer(Heap& heap, size_t k, double d, long id) {
+        if (heap.size() < k) {
+            heap.push(std::make_pair(d, id));
+        } else if (d < heap.top().first) {
+            heap.pop();
+            heap.push(std::make_pair(d, id));
+        }
+    }
+
+    void knnRec(size_t lo, size_t hi, int axis, Point const& q, size_t k, Heap& heap) const {
+        if (hi - lo <= KD_LEAF) {
+            for (size_t i = lo; i < hi; i++) {
+                offer(heap, k, getSquaredDistance(q, nodes[i].p), nodes[i].id);
+            }
+            return;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        offer(heap, k, getSquaredDistance(q, nodes[mid].p), nodes[mid].id);
+
+        double off = axisOffset(q, nodes[mid].p, axis);
+        size_t nearLo = off < 0 ? lo : mid + 1, nearHi = off < 0 ? mid : hi;
+        size_t farLo = off < 0 ? mid + 1 : lo, farHi = off < 0 ? hi : mid;
+        knnRec(nearLo, nearHi, axis ^ 1, q, k, heap);
+        if (heap.size() < k || off * off < heap.top().first) {
+            knnRec(farLo, farHi, axis ^ 1, q, k, heap);
+        }
+    }
+
+    void radiusRec(size_t lo, size_t hi, int axis, Point const& q, double r2,
+                   std::vector<long>& out) const {
+        if (hi - lo <= KD_LEAF) {
+            for (size_t i = lo; i < hi; i++) {
+                if (getSquaredDistance(q, nodes[i].p) <= r2) out.push_back(nodes[i].id);
+            }
+            return;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        if (getSquaredDistance(q, nodes[mid].p) <= r2) out.push_back(nodes[mid].id);
+
+        double off = axisOffset(q, nodes[mid].p, axis);
+        if (off <= 0 || off * off <= r2) radiusRec(lo, mid, axis ^ 1, q, r2, out);
+        if (off >= 0 || off * off <= r2) radiusRec(mid + 1, hi, axis ^ 1, q, r2, out);
+    }
+};
+
+/* Closest pair through the k-d tree: build, then one nearest-other query
+   per point. O(n log n), and the queries run in parallel.
+*/
+double closestPairKd(std::vector<Point> const& points) {
+    return KdTree(points).closestPair();
+}
+
+typedef double (*ClosestPairFn)(std::vector<Point> const&);
+
+struct Engine {
+    const char* name;
+    ClosestPairFn fn;
+    bool parallel;      // worth sweeping thread counts for
+    double tolerance;   // largest relative error validate accepts
+};
+
+static const Engine engines[] = {
+    { "brute",     closestPair,                     false, 1e-9 },
+    { "omp",       closestPairOmp,                  true,  1e-9 },
+    { "omp-float", closestPairOmpT<float, false>,   true,  1e-2 },
+    { "mixed",     closestPairOmpT<float, true>,    true,  1e-2 },
+    { "dc",        closestPairDC,                   false, 1e-9 },
+    { "grid",      closestPairGrid,                 false, 1e-9 },
+    { "kdtree",    closestPairKd,                   true,  1e-9 },
+};
+
+static const Engine* findEngine(const char* name) {
+    for (Engine const& e : engines) {
+        if (strcmp(e.name, name) == 0) return &e;
+    }
+    return nullptr;
+}
+
+void generatePoints(std::vector<Point>& points, int seed) {
     srand(seed);
 
     for (size_t i = 0; i < points.size(); i++) {
         points[i].x = (rand() / (double) RAND_MAX) * (POINTS_MAX - POINTS_MIN) + POINTS_MIN;
         points[i].y = (rand() / (double) RAND_MAX) * (POINTS_MAX - POINTS_MIN) + POINTS_MIN;
     }
+}
 
-    // double totalTime = 0.0;
-    // double start = omp_get_wtime();
+/* Run every engine against the brute-force reference on trials seeds
+   starting at seed, and report each engine's largest relative error.
+   Returns the number of results outside the engine's tolerance.
+*/
+int validate(int N, int seed, int trials) {
+    const size_t E = sizeof(engines) / sizeof(engines[0]);
+    int failures = 0;
+    std::vector<Point> points(N);
+    std::vector<double> maxErr(E, 0.0);
 
-    double dist = closestPair(points);
+    for (int t = 0; t < trials; t++) {
+        generatePoints(points, seed + t);
+        double ref = closestPair(points);
+        for (size_t e = 0; e < E; e++) {
+            double dist = engines[e].fn(points);
+            double err = std::abs(dist - ref) / std::max(ref, std::numeric_limits<double>::min());
+            if (ref == 0 && dist == 0) err = 0;
+            maxErr[e] = std::max(maxErr[e], err);
+            if (err > engines[e].tolerance) {
+                printf("MISMATCH seed %d: %s %.10f vs brute %.10f\n", seed + t, engines[e].name, dist, ref);
+                failures++;
+            }
+        }
+    }
+    for (size_t e = 0; e < E; e++) {
+        printf("%-10s max relative error %.3e\n", engines[e].name, maxErr[e]);
+    }
+    printf("Validated %d seeds of N=%d: %s\n", trials, N, failures ? "FAILED" : "ok");
+    return failures;
+}
+
+/* Query-serving mode: index the N points once, then answer Q random queries
+   of each kind (nearest, k nearest, within radius) plus one all-pairs-within-
+   radius sweep, timing each. The first few queries are checked against a
+   linear scan.
+*/
+int serveQueries(int N, int seed, int Q, int k, double r) {
+    std::vector<Point> points(N), queries(Q);
+    generatePoints(points, seed);
+    generatePoints(queries, seed + 1);
+
+    double start = omp_get_wtime();
+    KdTree tree(points);
+    printf("Build: %d points in %.5f s\n", N, omp_get_wtime() - start);
+
+    std::vector<long> nearest;
+    start = omp_get_wtime();
+    tree.nearestBatch(queries, nearest);
+    double t = omp_get_wtime() - start;
+    printf("Nearest: %d queries in %.5f s (%.0f/s)\n", Q, t, Q / t);
+
+    long knnTotal = 0, radiusTotal = 0;
+    start = omp_get_wtime();
+    #pragma omp parallel reduction(+:knnTotal)
+    {
+        std::vector<long> out;
+        #pragma omp for schedule(dynamic, 256)
+        for (int i = 0; i < Q; i++) {
+            tree.knn(queries[i], k, out);
+            knnTotal += out.size();
+        }
+    }
+    t = omp_get_wtime() - start;
+    printf("%d-NN: %d queries in %.5f s (%.0f/s)\n", k, Q, t, Q / t);
+
+    start = omp_get_wtime();
+    #pragma omp parallel reduction(+:radiusTotal)
+    {
+        std::vector<long> out;
+        #pragma omp for schedule(dynamic, 256)
+        for (int i = 0; i < Q; i++) {
+            tree.radius(queries[i], r, out);
+            radiusTotal += out.size();
+        }
+    }
+    t = omp_get_wtime() - start;
+    printf("Radius %.3f: %d queries in %.5f s (%.0f/s), %ld hits\n", r, Q, t, Q / t, radiusTotal);
+
+    std::vector< std::pair<long, long> > pairs;
+    start = omp_get_wtime();
+    tree.pairsWithin(r, pairs);
+    printf("Pairs within %.3f: %zu in %.5f s\n", r, pairs.size(), omp_get_wtime() - start);
+
+    // Spot-check against a linear scan
+    int failures = 0;
+    std::vector<long> out;
+    for (int i = 0; i < std::min(Q, 100); i++) {
+        std::vector< std::pair<double, long> > byDist(N);
+        long hits = 0;
+        for (int j = 0; j < N; j++) {
+            byDist[j] = std::make_pair(getSquaredDistance(queries[i], points[j]), (long)j);
+            hits += byDist[j].first <= r * r;
+        }
+        std::sort(byDist.begin(), byDist.end());
+
+        if (N > 0 && getSquaredDistance(queries[i], points[nearest[i]]) != byDist[0].first) failures++;
+        tree.knn(queries[i], k, out);
+        for (size_t j = 0; j < out.size(); j++) {
+            if (getSquaredDistance(queries[i], points[out[j]]) != byDist[j].first) { failures++; break; }
+        }
+        tree.radius(queries[i], r, out);
+        if ((long)out.size() != hits) failures++;
+    }
+    printf("Checked %d queries: %s\n", std::min(Q, 100), failures ? "FAILED" : "ok");
+    (void)knnTotal;
+    return failures;
+}
+
+/* Closest pair of a point file too large to load at once. The file must be
+   sorted by x (as -w writes it). Chunks of `chunk` points are taken in order;
+   each is solved together with the strip carried over from the chunks before
+   it, which holds every earlier point within the best distance so far of the
+   chunk's largest x. Any closer pair that crosses a chunk boundary has both
+   ends in that union, so the running minimum is exact. Consumed pages are
+   released as the scan moves on.
+*/
+double streamClosestPair(MappedFile const& in, size_t chunk, const Engine* engine) {
+    const Point* all = in.as<Point>();
+    size_t n = in.count<Point>();
+    double best = std::numeric_limits<double>::max();
+    std::vector<Point> work, carry;
+    size_t chunks = 0, maxCarry = 0;
+
+    for (size_t begin = 0; begin < n; begin += chunk) {
+        size_t end = std::min(n, begin + chunk);
+        for (size_t i = std::max<size_t>(begin, 1); i < end; i++) {
+            if (all[i].x < all[i - 1].x) {
+                fprintf(stderr, "chunked input must be sorted by x (point %zu)\n", i);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        work.assign(carry.begin(), carry.end());
+        work.insert(work.end(), all + begin, all + end);
+        if (work.size() >= 2) {
+            best = std::min(best, engine->fn(work));
+        }
+
+        double edge = all[end - 1].x - best;
+        carry.clear();
+        for (Point const& p : work) {
+            if (p.x >= edge) carry.push_back(p);
+        }
+        maxCarry = std::max(maxCarry, carry.size());
+        chunks++;
+
+        in.release(begin * sizeof(Point), end * sizeof(Point));
+    }
+
+    printf("Chunks: %zu of %zu points, largest carried strip %zu\n", chunks, chunk, maxCarry);
+    return n < 2 ? 0 : best;
+}
+
+/* Time every engine (or just the selected one) for each N and thread count.
+   GFLOP/s is pair-equivalent: 6 flops for each of the n(n-1)/2 pairs the
+   brute force examines, whatever the engine actually does, so it also
+   reads as an algorithmic speedup. The reference is serial brute force.
+*/
+void benchmark(BenchOptions const& opts, const Engine* only, int seed) {
+    BenchReport report(opts.csv);
+
+    for (long N : opts.sizes) {
+        std::vector<Point> points(N);
+        generatePoints(points, seed);
+        double flops = 6.0 * N * (N - 1) / 2;
+        volatile double sink;
+
+        omp_set_num_threads(1);
+        double refTime = benchTime([&] { sink = closestPair(points); }, opts.reps);
+        report.add("brute", N, 1, opts.reps, refTime, flops, refTime);
+
+        for (Engine const& e : engines) {
+            if (e.fn == closestPair || (only && only != &e)) continue;
+            for (int T : opts.threads) {
+                omp_set_num_threads(e.parallel ? T : 1);
+                double t = benchTime([&] { sink = e.fn(points); }, opts.reps);
+                report.add(e.name, N, e.parallel ? T : 1, opts.reps, t, flops, refTime);
+                if (!e.parallel) break;
+            }
+        }
+        (void)sink;
+    }
+}
+
+int main(int argc, char **argv) {
+    int N = 1024;
+    int seed = 17;
+    int trials = 0;
+    int queries = 0, k = 8;
+    double radius = 5.0;
+    bool bench = false;
+    const char* inputPath = nullptr;
+    const char* outputPath = nullptr;
+    size_t chunk = 0;
+    BenchOptions benchOpts;
+    const Engine* engine = &engines[0];
+    const Engine* selected = nullptr;
+
+    const char* usage = "Usage: %1$s [-a brute|omp|omp-float|mixed|dc|grid|kdtree] [-v trials] [N [seed]]\n"
+                        "       %1$s -f file [-c chunk] [-a engine]\n"
+                        "       %1$s -w file [N [seed]]\n"
+                        "       %1$s -q queries [-k k] [-R radius] [N [seed]]\n"
+                        "       %1$s -b [-a engine] [-N sizes] [-T threads] [-r reps] [-o csv] [seed]\n";
+    int opt;
+    while ((opt = getopt(argc, argv, "a:v:q:k:R:f:w:c:bN:T:r:o:")) != -1) {
+        switch (opt) {
+            case 'a':
+                engine = selected = findEngine(optarg);
+                if (!engine) {
+                    fprintf(stderr, usage, argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'v':
+                trials = std::stoi(optarg);
+                break;
+            case 'q':
+                queries = std::stoi(optarg);
+                break;
+            case 'k':
+                k = std::stoi(optarg);
+                break;
+            case 'R':
+                radius = std::stod(optarg);
+                break;
+            case 'f':
+                inputPath = optarg;
+                break;
+            case 'w':
+                outputPath = optarg;
+                break;
+            case 'c':
+                chunk = std::stol(optarg);
+                break;
+            case 'b':
+                bench = true;
+                break;
+            case 'N':
+                benchOpts.sizes = parseList<long>(optarg);
+                break;
+            case 'T':
+                benchOpts.threads = parseList<int>(optarg);
+                break;
+            case 'r':
+                benchOpts.reps = std::max(1, std::stoi(optarg));
+                break;
+            case 'o':
+                benchOpts.csv = optarg;
+                break;
+            default:
+                fprintf(stderr, usage, argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (bench) {
+        if (argc - optind >= 1) seed = std::stoi(argv[optind]);
+        if (benchOpts.sizes.empty()) benchOpts.sizes = { 1024, 4096, 16384 };
+        if (benchOpts.threads.empty()) {
+            benchOpts.threads = { 1 };
+            if (omp_get_max_threads() > 1) benchOpts.threads.push_back(omp_get_max_threads());
+        }
+        benchmark(benchOpts, selected, seed);
+        return EXIT_SUCCESS;
+    }
+
+    if (argc - optind >= 1) {
+        N = std::stoi(argv[optind]);
+    }
+    if (argc - optind >= 2) {
+	    seed = std::stoi(argv[optind+1]);
+    }
+
+    if (trials > 0) {
+        return validate(N, seed, trials) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    if (queries > 0) {
+        return serveQueries(N, seed, queries, k, radius) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (outputPath) {
+        std::vector<Point> points(N);
+        generatePoints(points, seed);
+        std::sort(points.begin(), points.end(), [](Point const& a, Point const& b) { return a.x < b.x; });
+        writeFile(outputPath, points.data(), points.size() * sizeof(Point));
+        printf("Wrote %d points to %s\n", N, outputPath);
+        return EXIT_SUCCESS;
+    }
+
+    double totalTime = 0.0;
+    double start = omp_get_wtime();
+    double dist;
+
+    if (inputPath && chunk > 0) {
+        MappedFile in(inputPath);
+        dist = streamClosestPair(in, chunk, engine);
+    } else if (inputPath) {
+        MappedFile in(inputPath);
+        std::vector<Point> points(in.as<Point>(), in.as<Point>() + in.count<Point>());
+        dist = engine->fn(points);
+    } else {
+        std::vector<Point> points(N);
+        generatePoints(points, seed);
+        start = omp_get_wtime();
+        dist = engine->fn(points);
+    }
     printf("Distance: %.5f\n", dist);
 
-    // totalTime = omp_get_wtime() - start;
-    // printf("Time: %.5f\n", totalTime);
+    totalTime = omp_get_wtime() - start;
+    printf("Time: %.5f\n", totalTime);
 }
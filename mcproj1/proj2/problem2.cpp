@@ -1,11 +1,23 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <cmath>
 #include <vector>
 #include <complex>
+#include <string>
+#include <omp.h>
+#include "bench.h"
+#include "input.h"
 
 #define POINTS_MIN  -1.0
 #define POINTS_MAX  1.0
 
+// Longer signals are checked on CHECK_BINS sampled bins instead of a full dft
+#define FULL_CHECK_MAX  16384
+#define CHECK_BINS      64
+#define STREAM_FRAMES   64      // frames per rfftBatch call in the streaming mode
+
 #if !defined(M_PI)
 #define M_PI 3.14159265358979323846
 #endif
@@ -34,42 +46,608 @@ void dft(std::vector<double> const& x, std::vector< std::complex<double> > &outp
     }
 }
 
+/* Bin k of the DFT of x on its own. The angle is reduced modulo N in integer
+   arithmetic first, so it stays accurate for the long signals where the full
+   O(N^2) dft is out of reach and only a sample of bins can be checked.
+*/
+std::complex<double> dftBin(std::vector<double> const& x, long k) {
+    long N = x.size();
+    double re = 0.0, im = 0.0;
+    for (long n = 0; n < N; n++) {
+        double theta = 2 * M_PI * (double)((unsigned long long)k * n % N) / N;
+        re += x[n] * std::cos(theta);
+        im -= x[n] * std::sin(theta);
+    }
+    return std::complex<double>(re, im);
+}
+
+/* dft with the O(N^2) trig calls replaced by a table: cos and sin of
+   2*pi*j/N are computed once, in separate real/imag arrays, and bin k reads
+   entry (k*n) mod N. The bins are independent, so OpenMP splits k statically
+   (every bin costs the same). Within a bin, one vector's worth of consecutive
+   n (8 doubles or 16 floats) run side by side, each lane stepping its table
+   index by lanes*k mod N, so the multiply-accumulate vectorises with gathers
+   instead of a serial index chain.
+
+   T is the precision of the table, the input copy and the per-lane sums;
+   the lanes are added up in double. Indices are int, so N < 2^30.
+*/
+template<class T>
+void dftOmpT(std::vector<double> const& x, std::vector< std::complex<double> > &output) {
+    const int LANES = 64 / sizeof(T);
+    int N = x.size();
+    std::vector<T> cosT(N), sinT(N), xs(N);
+
+    output.resize(N);
+
+    #pragma omp parallel
+    {
+        #pragma omp for schedule(static)
+        for (int j = 0; j < N; j++) {
+            double theta = 2 * M_PI * j / N;
+            cosT[j] = (T)std::cos(theta);
+            sinT[j] = (T)std::sin(theta);
+            xs[j] = (T)x[j];
+        }
+
+        #pragma omp for schedule(static)
+        for (int k = 0; k < N; k++) {
+            int lane[LANES];
+            T re[LANES] = {}, im[LANES] = {};
+            int step = (long)LANES * k % N;
+            for (int l = 0; l < LANES; l++) {
+                lane[l] = (long)k * l % N;
+            }
+
+            int n = 0;
+            for (; n + LANES <= N; n += LANES) {
+                #pragma omp simd
+                for (int l = 0; l < LANES; l++) {
+                    int i = lane[l];
+                    re[l] += xs[n + l] * cosT[i];
+                    im[l] -= xs[n + l] * sinT[i];
+                    i += step;
+                    lane[l] = i >= N ? i - N : i;
+                }
+            }
+            for (int l = 0; n < N; n++, l++) {
+                re[l] += xs[n] * cosT[lane[l]];
+                im[l] -= xs[n] * sinT[lane[l]];
+            }
+
+            double sumRe = 0.0, sumIm = 0.0;
+            for (int l = 0; l < LANES; l++) {
+                sumRe += re[l];
+                sumIm += im[l];
+            }
+            output[k] = std::complex<double>(sumRe, sumIm);
+        }
+    }
+}
+
+void dftOmp(std::vector<double> const& x, std::vector< std::complex<double> > &output) {
+    dftOmpT<double>(x, output);
+}
+
+typedef std::complex<double> Complex;
+
+static inline Complex cmul(Complex a, Complex b) {
+    // std::complex operator* goes through __muldc3 for its inf/nan rules
+    return Complex(a.real() * b.real() - a.imag() * b.imag(),
+                   a.real() * b.imag() + a.imag() * b.real());
+}
+
+/* Twiddles exp(-2*pi*i*j/N), j < N/2, for a power-of-two N. Each one comes
+   straight from cos/sin (no recurrence, so no drift at large N).
+*/
+void makeTwiddles(std::vector<Complex> &w, size_t N) {
+    w.resize(N / 2);
+    for (size_t j = 0; j < N / 2; j++) {
+        double theta = 2 * M_PI * j / N;
+        w[j] = Complex(std::cos(theta), -std::sin(theta));
+    }
+}
+
+/* In-place iterative radix-2 FFT of a[0..N), N a power of two, using the
+   twiddles of the last stage (strided for the earlier ones). The inverse
+   conjugates the twiddles and is unscaled.
+*/
+void fftRadix2(Complex *a, size_t N, Complex const *w, bool inverse) {
+    if (N < 2) return;
+
+    for (size_t i = 1, j = 0; i < N; i++) {
+        size_t bit = N >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(a[i], a[j]);
+    }
+
+    for (size_t len = 2; len <= N; len <<= 1) {
+        size_t half = len / 2, step = N / len;
+        for (size_t i = 0; i < N; i += len) {
+            for (size_t j = 0; j < half; j++) {
+                Complex t = inverse ? std::conj(w[j * step]) : w[j * step];
+                Complex u = a[i + j];
+                Complex v = cmul(a[i + j + half], t);
+                a[i + j] = u + v;
+                a[i + j + half] = u - v;
+            }
+        }
+    }
+}
+
+/* Forward complex FFT of one length N, with everything that depends only on
+   N computed up front so transforms can run without allocating. Powers of two
+   run radix-2 directly. Other lengths use Bluestein's chirp-z: the transform
+   becomes a convolution with the chirp exp(-i*pi*n^2/N), done with radix-2
+   FFTs of length M >= 2N-1 (n^2 is reduced modulo 2N before it becomes an
+   angle). Only Bluestein needs scratch, M elements per concurrent transform.
+*/
+struct FFTPlan {
+    size_t N;
+    size_t M;                       // radix-2 length actually run
+    std::vector<Complex> w;         // twiddles for length M
+    std::vector<Complex> chirp;     // Bluestein only
+    std::vector<Complex> kernel;    // FFT of the conjugate chirp, scaled by 1/M
+
+    explicit FFTPlan(size_t n) : N(n), M(1) {
+        if ((N & (N - 1)) == 0) {
+            M = N;
+            makeTwiddles(w, M);
+            return;
+        }
+
+        while (M < 2 * N - 1) M <<= 1;
+        makeTwiddles(w, M);
+
+        chirp.resize(N);
+        for (size_t n = 0; n < N; n++) {
+            unsigned long long r = (unsigned long long)n * n % (2 * N);
+            double theta = M_PI * (double)r / N;
+            chirp[n] = Complex(std::cos(theta), -std::sin(theta));
+        }
+
+        kernel.assign(M, Complex(0, 0));
+        kernel[0] = std::conj(chirp[0]);
+        for (size_t n = 1; n < N; n++) {
+            kernel[n] = kernel[M - n] = std::conj(chirp[n]);
+        }
+        fftRadix2(kernel.data(), M, w.data(), false);
+        for (size_t i = 0; i < M; i++) {
+            kernel[i] *= 1.0 / M;
+        }
+    }
+
+    size_t scratchSize() const { return chirp.empty() ? 0 : M; }
+
+    void forward(Complex *a, Complex *scratch) const {
+        if (chirp.empty()) {
+            fftRadix2(a, N, w.data(), false);
+            return;
+        }
+
+        for (size_t n = 0; n < N; n++) {
+            scratch[n] = cmul(a[n], chirp[n]);
+        }
+        std::fill(scratch + N, scratch + M, Complex(0, 0));
+
+        fftRadix2(scratch, M, w.data(), false);
+        for (size_t i = 0; i < M; i++) {
+            scratch[i] = cmul(scratch[i], kernel[i]);
+        }
+        fftRadix2(scratch, M, w.data(), true);
+
+        for (size_t k = 0; k < N; k++) {
+            a[k] = cmul(scratch[k], chirp[k]);
+        }
+    }
+};
+
+/* Same result as dft in O(N log N): radix-2 when N is a power of two,
+   Bluestein otherwise.
+*/
+void fft(std::vector<double> const& x, std::vector<Complex> &output) {
+    size_t N = x.size();
+    FFTPlan plan(N);
+    std::vector<Complex> scratch(plan.scratchSize());
+
+    output.resize(N);
+    for (size_t n = 0; n < N; n++) {
+        output[n] = Complex(x[n], 0.0);
+    }
+    plan.forward(output.data(), scratch.data());
+}
+
+/* Transform of real signals of length N. The output is Hermitian
+   (X[N-k] = conj(X[k])), so only the bins() = N/2+1 non-redundant bins are
+   produced. For even N the samples are packed as z[n] = x[2n] + i*x[2n+1]
+   and one complex FFT of length N/2 is run, half the work of a complex
+   transform. The two interleaved spectra are then separated with the
+   twiddles in split. Odd N runs a full-length complex FFT.
+*/
+struct RealFFTPlan {
+    size_t N;
+    FFTPlan inner;                  // length N/2, or N when N is odd
+    std::vector<Complex> split;     // exp(-2*pi*i*k/N), k <= N/2, even N only
+
+    explicit RealFFTPlan(size_t n) : N(n), inner(n % 2 == 0 ? n / 2 : n) {
+        if (N % 2 == 0) {
+            split.resize(N / 2 + 1);
+            for (size_t k = 0; k <= N / 2; k++) {
+                double theta = 2 * M_PI * k / N;
+                split[k] = Complex(std::cos(theta), -std::sin(theta));
+            }
+        }
+    }
+
+    // an empty signal has an empty spectrum
+    size_t bins() const { return N == 0 ? 0 : N / 2 + 1; }
+
+    // complex elements one concurrent transform needs
+    size_t scratchSize() const { return inner.N + inner.scratchSize(); }
+
+    void forward(double const *x, Complex *out, Complex *scratch) const {
+        Complex *z = scratch;
+        Complex *rest = scratch + inner.N;
+
+        if (N == 0) return;
+        if (N % 2 != 0) {
+            for (size_t n = 0; n < N; n++) {
+                z[n] = Complex(x[n], 0.0);
+            }
+            inner.forward(z, rest);
+            std::copy(z, z + bins(), out);
+            return;
+        }
+
+        size_t half = N / 2;
+        for (size_t n = 0; n < half; n++) {
+            z[n] = Complex(x[2 * n], x[2 * n + 1]);
+        }
+        inner.forward(z, rest);
+
+        for (size_t k = 0; k <= half; k++) {
+            Complex zk = z[k % half];
+            Complex zc = std::conj(z[(half - k) % half]);
+            Complex even = (zk + zc) * 0.5;
+            Complex odd = cmul(zk - zc, Complex(0.0, -0.5));
+            out[k] = even + cmul(split[k], odd);
+        }
+    }
+};
+
+/* Transform count real signals of length plan.N in one call. Signal s is
+   read from x + s*stride (stride 0 means back to back, stride N; a smaller
+   stride gives overlapping frames of one long signal) and its plan.bins()
+   bins are written to out + s*bins().
+   The plan (twiddles, chirp) is shared by every signal, and the signals are
+   split across OpenMP threads. scratch is grown to one slice per thread on
+   the first call and reused afterwards, so repeated batches do not allocate.
+*/
+void rfftBatch(RealFFTPlan const& plan, double const *x, size_t count,
+               Complex *out, std::vector<Complex> &scratch, size_t stride = 0) {
+    size_t slice = plan.scratchSize();
+    if (stride == 0) stride = plan.N;
+    size_t threads = omp_get_max_threads();
+    if (scratch.size() < threads * slice) {
+        scratch.resize(threads * slice);
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t s = 0; s < count; s++) {
+        plan.forward(x + s * stride, out + s * plan.bins(),
+                     scratch.data() + omp_get_thread_num() * slice);
+    }
+}
+
+/* Single-signal adapter for the transform table: real-input FFT, with the
+   upper half of the spectrum filled in from the Hermitian symmetry.
+*/
+void rfft(std::vector<double> const& x, std::vector<Complex> &output) {
+    size_t N = x.size();
+    RealFFTPlan plan(N);
+    std::vector<Complex> scratch;
+
+    output.resize(N);
+    rfftBatch(plan, x.data(), 1, output.data(), scratch);
+    for (size_t k = plan.bins(); k < N; k++) {
+        output[k] = std::conj(output[N - k]);
+    }
+}
+
+typedef void (*TransformFn)(std::vector<double> const&, std::vector< std::complex<double> >&);
+
+struct Transform {
+    const char* name;
+    TransformFn fn;
+    bool parallel;      // worth sweeping thread counts for
+};
+
+static const Transform transforms[] = {
+    { "dft", dft, false },
+    { "omp", dftOmp, true },
+    { "omp-float", dftOmpT<float>, true },
+    { "fft", fft, false },
+    { "rfft", rfft, false },
+};
+
+const Transform* findTransform(const char* name) {
+    for (Transform const& t : transforms) {
+        if (strcmp(t.name, name) == 0) return &t;
+    }
+    return nullptr;
+}
+
+void generateSignal(std::vector<double> &x, int seed) {
+    srand(seed);
+    for (size_t i = 0; i < x.size(); i += 1) {
+        x[i] = (rand() / (double) RAND_MAX) * (POINTS_MAX - POINTS_MIN) + POINTS_MIN;
+    }
+}
+
+/* Time every transform (or just the selected one) for each N and thread count.
+   GFLOP/s is counted as for the direct DFT, 4 flops per real-by-complex
+   multiply-add and N^2 of them, so faster algorithms show up as higher
+   effective GFLOP/s. The reference is the serial dft. With batch > 0 the
+   batched real-input API is also timed on that many signals per call,
+   reported per signal.
+*/
+void benchmark(BenchOptions const& opts, const Transform* only, int seed, int batch) {
+    BenchReport report(opts.csv);
+
+    for (long N : opts.sizes) {
+        std::vector<double> x(N);
+        std::vector< std::complex<double> > out(N);
+        generateSignal(x, seed);
+        double flops = 4.0 * N * N;
+
+        omp_set_num_threads(1);
+        double refTime = benchTime([&] { dft(x, out); }, opts.reps);
+        report.add("dft", N, 1, opts.reps, refTime, flops, refTime);
+
+        for (Transform const& t : transforms) {
+            if (t.fn == dft || (only && only != &t)) continue;
+            for (int T : opts.threads) {
+                omp_set_num_threads(t.parallel ? T : 1);
+                double sec = benchTime([&] { t.fn(x, out); }, opts.reps);
+                report.add(t.name, N, t.parallel ? T : 1, opts.reps, sec, flops, refTime);
+                if (!t.parallel) break;
+            }
+        }
+
+        if (batch > 0 && (!only || only->fn == rfft)) {
+            RealFFTPlan plan(N);
+            std::vector<double> signals(batch * N);
+            std::vector< std::complex<double> > spectra(batch * plan.bins());
+            std::vector< std::complex<double> > scratch;
+            for (int s = 0; s < batch; s++) {
+                std::copy(x.begin(), x.end(), signals.begin() + s * N);
+            }
+            for (int T : opts.threads) {
+                omp_set_num_threads(T);
+                double sec = benchTime([&] {
+                    rfftBatch(plan, signals.data(), batch, spectra.data(), scratch);
+                }, opts.reps) / batch;
+                report.add("rfft-batch", N, T, opts.reps, sec, flops, refTime);
+            }
+        }
+    }
+}
+
+/* Block transform of a signal file too large to hold: a frame of block
+   samples every hop samples (hop < block overlaps them), each turned into
+   its block/2+1 real-input bins. Frames are read straight from the mapping,
+   STREAM_FRAMES per rfftBatch call with one shared plan, and the pages
+   before the next frame are released as the scan moves on. Spectra go to
+   outPath if given; the power of each bin is summed over all frames so the
+   dominant frequency can be reported. Frame 0 is spot-checked against
+   dftBin. Returns the number of spot-check failures.
+*/
+int streamSpectra(MappedFile const& in, size_t block, size_t hop,
+                  const char* outPath, double tolerance) {
+    const double* x = in.as<double>();
+    size_t n = in.count<double>();
+    size_t frames = n >= block ? (n - block) / hop + 1 : 0;
+
+    RealFFTPlan plan(block);
+    size_t bins = plan.bins();
+    std::vector<Complex> spectra(STREAM_FRAMES * bins), scratch;
+    std::vector<double> power(bins, 0.0);
+    int failures = 0;
+
+    FILE* out = nullptr;
+    if (outPath && !(out = fopen(outPath, "wb"))) {
+        perror(outPath);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t released = 0;
+    for (size_t f = 0; f < frames; f += STREAM_FRAMES) {
+        size_t count = std::min<size_t>(STREAM_FRAMES, frames - f);
+        rfftBatch(plan, x + f * hop, count, spectra.data(), scratch, hop);
+
+        if (f == 0) {
+            std::vector<double> frame(x, x + block);
+            for (size_t j = 0; j < std::min<size_t>(CHECK_BINS, bins); j++) {
+                long k = j * (bins / std::min<size_t>(CHECK_BINS, bins));
+                if (std::abs(dftBin(frame, k) - spectra[k]) > tolerance) failures++;
+            }
+        }
+        for (size_t s = 0; s < count; s++) {
+            for (size_t k = 0; k < bins; k++) {
+                power[k] += std::norm(spectra[s * bins + k]);
+            }
+        }
+        if (out && fwrite(spectra.data(), sizeof(Complex), count * bins, out) != count * bins) {
+            perror(outPath);
+            exit(EXIT_FAILURE);
+        }
+
+        size_t next = std::min(n, (f + count) * hop);
+        in.release(released * sizeof(double), next * sizeof(double));
+        released = next;
+    }
+    if (out) fclose(out);
+
+    // Skip the DC bin, which only reflects the signal's mean
+    size_t peak = bins > 1 ? 1 : 0;
+    for (size_t k = 1; k < bins; k++) {
+        if (power[k] > power[peak]) peak = k;
+    }
+    printf("Frames: %zu of %zu samples, hop %zu\n", frames, block, hop);
+    printf("Peak bin: %zu (%.5f cycles/sample)\n", peak, (double)peak / block);
+    printf("Correct? %s\n", failures ? "false" : "true");
+    return failures;
+}
+
 int main(int argc, char **argv) {
     int N = 1024;
     int seed = 273;
+    bool bench = false;
+    int batch = 0;
+    double tolerance = 1e-4;
+    const char* inputPath = nullptr;
+    const char* outputPath = nullptr;
+    const char* spectraPath = nullptr;
+    size_t block = 0, hop = 0;
+    BenchOptions benchOpts;
+    const Transform* transform = &transforms[0];
+    const Transform* selected = nullptr;
 
-    if (argc == 2) {
-        N = std::stoi(argv[1]);
+    const char* usage = "Usage: %1$s [-a dft|omp|omp-float|fft|rfft] [-e tolerance] [N [seed]]\n"
+                        "       %1$s -f file [-a transform] [-e tolerance]\n"
+                        "       %1$s -f file -c block [-H hop] [-O spectra]\n"
+                        "       %1$s -w file [N [seed]]\n"
+                        "       %1$s -b [-a transform] [-N sizes] [-T threads] [-r reps] [-S signals] [-o csv] [seed]\n";
+    int opt;
+    while ((opt = getopt(argc, argv, "a:e:f:w:c:H:O:bN:T:r:S:o:")) != -1) {
+        switch (opt) {
+            case 'a':
+                transform = selected = findTransform(optarg);
+                if (!transform) {
+                    fprintf(stderr, usage, argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'e':
+                tolerance = std::stod(optarg);
+                break;
+            case 'f':
+                inputPath = optarg;
+                break;
+            case 'w':
+                outputPath = optarg;
+                break;
+            case 'c':
+                block = std::stol(optarg);
+                break;
+            case 'H':
+                hop = std::stol(optarg);
+                break;
+            case 'O':
+                spectraPath = optarg;
+                break;
+            case 'b':
+                bench = true;
+                break;
+            case 'N':
+                benchOpts.sizes = parseList<long>(optarg);
+                break;
+            case 'T':
+                benchOpts.threads = parseList<int>(optarg);
+                break;
+            case 'r':
+                benchOpts.reps = std::max(1, std::stoi(optarg));
+                break;
+            case 'S':
+                batch = std::stoi(optarg);
+                break;
+            case 'o':
+                benchOpts.csv = optarg;
+                break;
+            default:
+                fprintf(stderr, usage, argv[0]);
+                exit(EXIT_FAILURE);
+        }
     }
-    if (argc == 3) {
-	    N = std::stoi(argv[1]);
-	    seed = std::stoi(argv[2]);
+
+    if (bench) {
+        if (argc - optind >= 1) seed = std::stoi(argv[optind]);
+        if (benchOpts.sizes.empty()) benchOpts.sizes = { 1024, 2048, 4096 };
+        if (benchOpts.threads.empty()) {
+            benchOpts.threads = { 1 };
+            if (omp_get_max_threads() > 1) benchOpts.threads.push_back(omp_get_max_threads());
+        }
+        benchmark(benchOpts, selected, seed, batch);
+        return EXIT_SUCCESS;
     }
 
-    std::vector<double> x(N);
-    std::vector< std::complex<double> > correct(N), test(N);
-    srand(seed);
+    if (argc - optind >= 1) {
+        N = std::stoi(argv[optind]);
+    }
+    if (argc - optind >= 2) {
+	    seed = std::stoi(argv[optind + 1]);
+    }
 
-    for (int i = 0; i < N; i += 1) {
-        x[i] = (rand() / (double) RAND_MAX) * (POINTS_MAX - POINTS_MIN) + POINTS_MIN;
+    if (outputPath) {
+        std::vector<double> x(N);
+        generateSignal(x, seed);
+        writeFile(outputPath, x.data(), x.size() * sizeof(double));
+        printf("Wrote %d samples to %s\n", N, outputPath);
+        return EXIT_SUCCESS;
     }
 
-    // double totalTime = 0.0;
-    // double start = omp_get_wtime();
+    if (inputPath && block > 0) {
+        MappedFile in(inputPath);
+        double start = omp_get_wtime();
+        int failures = streamSpectra(in, block, hop ? hop : std::max<size_t>(1, block / 2),
+                                     spectraPath, tolerance);
+        printf("Time: %.5f\n", omp_get_wtime() - start);
+        return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
 
-    dft(x, correct);
-    dft(x, test);
+    std::vector<double> x;
+    if (inputPath) {
+        MappedFile in(inputPath);
+        x.assign(in.as<double>(), in.as<double>() + in.count<double>());
+        N = x.size();
+    } else {
+        x.resize(N);
+        generateSignal(x, seed);
+    }
+    std::vector< std::complex<double> > correct(N), test(N);
+
+    double totalTime = 0.0;
+
+    std::vector<long> bins;
+    if (N <= FULL_CHECK_MAX) {
+        dft(x, correct);
+        for (long j = 0; j < N; j++) bins.push_back(j);
+    } else {
+        for (long j = 0; j < CHECK_BINS; j++) {
+            long k = j * (N / CHECK_BINS) + j % 7;
+            correct[k] = dftBin(x, k);
+            bins.push_back(k);
+        }
+    }
 
+    double start = omp_get_wtime();
+    transform->fn(x, test);
+    totalTime = omp_get_wtime() - start;
+
+    // Relative error is taken against the largest reference bin, since
+    // individual bins of a random signal can be arbitrarily close to 0
     bool isCorrect = true;
-    for (int j = 0; j < x.size(); j += 1) {
-        if (std::abs(correct[j].real() - test[j].real()) > 1e-4 || std::abs(correct[j].imag() - test[j].imag()) > 1e-4) {
+    double maxAbsErr = 0.0, maxRef = 0.0;
+    for (long j : bins) {
+        if (std::abs(correct[j].real() - test[j].real()) > tolerance || std::abs(correct[j].imag() - test[j].imag()) > tolerance) {
             isCorrect = false;
-            break;
         }
+        maxAbsErr = std::max(maxAbsErr, std::abs(correct[j] - test[j]));
+        maxRef = std::max(maxRef, std::abs(correct[j]));
     }
 
     printf("Correct? %s\n", isCorrect?"true":"false");
-
-    // totalTime = omp_get_wtime() - start;
-    // printf("Time: %.5f\n", totalTime);
+    printf("Max error: %.3e abs, %.3e relative\n", maxAbsErr, maxRef > 0 ? maxAbsErr / maxRef : 0.0);
+    printf("Time: %.5f\n", totalTime);
 }